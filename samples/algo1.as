@@ -23,24 +23,36 @@ void setup(meta_data p) {
 }
 
 // This algorithm doesn't need a prepass.
-// Just as an example, compute the average iterations
-double iter_sum;
-double point_count;
-double iter_avg;
-void prepass(point_data@ p) {
+// Just as an example, compute the average iterations.
+//
+// The prepass collects into a prepass_state rather than globals so that
+// the colorator can split the rows between threads, each with its own
+// state. The states are then merged into one for precolor.
+class prepass_state {
+    double iter_sum = 0;
+    double point_count = 0;
+
+    void merge(prepass_state@ other) {
+        iter_sum += other.iter_sum;
+        point_count += other.point_count;
+    }
+};
+
+void prepass(point_data@ p, prepass_state@ state) {
     // most of the other data isn't valid unless
     // diverged is true
     if (p.diverged) {
-        iter_sum += p.iterations;
-        point_count += 1;
+        state.iter_sum += p.iterations;
+        state.point_count += 1;
     }
 }
 
 // Again, the algorithm doesn't need this
 // but show how to use precolor to finish the 
 // statistics from above
-void precolor() {
-    iter_avg = iter_sum/point_count;
+double iter_avg;
+void precolor(prepass_state@ totals) {
+    iter_avg = totals.iter_sum/totals.point_count;
 
     // use the logger
     logger("Average iterations = " + iter_avg + "\n");
@@ -49,6 +61,9 @@ void precolor() {
 
 
 // This is the function that actually does the coloring.
+// It only reads the globals, so the colorator may run it on several
+// threads at once.
+[parallel]
 color colorize(point_data@ p) {
 
     if (p.diverged) {
@@ -25,6 +25,8 @@ void setup(meta_data p) {
     logger("max = "+ max_iter+ "\n");
 }
 
+// Only reads the globals, so it may be run on several threads at once.
+[parallel]
 color colorize(point_data@ p) {
 
     if (p.diverged) {
@@ -126,25 +126,30 @@ void setup(meta_data p, args@ a) {
 }
 
 
-// Compute a histogram. Not sure what we'll do with it but lets just see
-// it. 
-//
+// Fill the histogram buckets. The colorator has already counted the
+// diverged points for each iteration count, so there is no need for a
+// prepass over every point.
 //
 int total_diverged;
 
-void prepass(point_data@ r) {
-    if (r.diverged) {
-        total_diverged += 1;
-        int scaled = r.iterations-min_iter;
+void fill_buckets() {
+    total_diverged = int(diverged_count());
+
+    for (int iterations = min_iter; iterations <= max_iter; ++iterations) {
+        int count = int(histogram(iterations));
+        if (count == 0) {
+            continue;
+        }
+
+        int scaled = iterations-min_iter;
         int bucket_index = scaled / int(bucket_size+1);
         for (int i = bucket_index; i < BUCKET_COUNT; ++i) {
             if (buckets[i].limit > scaled) {
-                buckets[i].count += 1;
+                buckets[i].count += count;
                 break;
             }
         }
     }
-
 }
 
 // ---------------------------------------------------------
@@ -156,6 +161,8 @@ double erf_scale;
 
 
 void precolor() {
+    fill_buckets();
+
     for (int i = 0; i < BUCKET_COUNT; ++i) {
         logger("Bucket " + i + " = " + buckets[i].count + "\n");
     }
@@ -266,16 +273,12 @@ double compute_value(double x) {
 
 // ---------------------------------------------------------
 // Lets color things!
+//
+// colorize() only reads the globals, so it is safe for the colorator
+// to call it for several points at once.
 // ---------------------------------------------------------
-int row = 0;
-int column = -1;
-color colorize(point_data@ r) {
-
-    column += 1;
-    if ( column >= total_columns) {
-        column = 0;
-        row += 1;
-    }
+[parallel]
+color colorize(point_data@ r, int row, int column) {
 
     if ( config.show_mid_point && 
             row < mid_row_count+1 && row > mid_row_count -1 && 
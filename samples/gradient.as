@@ -0,0 +1,40 @@
+/*
+ * Smooth coloring through a palette.
+ *
+ * The palette is a gradient set up once in setup(). Each pixel is then a
+ * single native lookup, cycling through the palette every `period`
+ * iterations.
+ *
+ * Sample invocation:
+ *
+ *  build/colorator -i sample.fract -o sample.bmp -s gradient.as --args 'period=32;'
+ */
+
+class args {
+    // iterations for one trip through the palette
+    double period = 64.0;
+};
+
+gradient palette;
+double period;
+
+void setup(meta_data p, args@ a) {
+    period = a.period;
+
+    // the classic dark blue - white - gold - black palette
+    palette.add_stop(0.0,    rgb(0, 7, 100));
+    palette.add_stop(0.16,   rgb(32, 107, 203));
+    palette.add_stop(0.42,   rgb(237, 255, 255));
+    palette.add_stop(0.6425, rgb(255, 170, 0));
+    palette.add_stop(0.8575, rgb(0, 2, 0));
+    palette.add_stop(1.0,    rgb(0, 7, 100));
+}
+
+[pure]
+color colorize(point_data@ p) {
+    if (p.diverged) {
+        return palette.cycle(p.smooth_iterations / period);
+    } else {
+        return black();
+    }
+}
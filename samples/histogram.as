@@ -0,0 +1,62 @@
+/*
+ * Histogram equalization.
+ *
+ * The colorator knows the distribution of the iteration counts, so
+ * cdf() turns the smoothed count of a point into the fraction of the
+ * diverged points that escaped faster. That fraction is spread evenly
+ * over [0, 1] whatever the zoom or limit, and is used to go around the
+ * color wheel from blue.
+ *
+ * Points below the given percentile are drawn dark to show the outer
+ * bands.
+ *
+ * Sample invocation:
+ *
+ *  build/colorator -i sample.fract -o sample.bmp -s histogram.as --args 'dark_percentile=0.05;'
+ */
+
+class args {
+    // fraction of the points (fastest escaping) that are drawn dark
+    double dark_percentile = 0.0;
+};
+
+double dark_below;
+
+void setup(meta_data p, args@ a) {
+    dark_below = percentile(a.dark_percentile);
+
+    logger("median smoothed count = " + percentile(0.5) + "\n");
+    logger("dark below = " + dark_below + "\n");
+}
+
+// Called once per row instead of colorize() for each point, which saves
+// a script call per pixel. Rows can be colored in parallel since only
+// the arguments are changed.
+[parallel]
+void colorize_row(const point_data[]@ row, color[]@ colors) {
+
+    for (uint j = 0; j < row.length(); ++j) {
+        colors[j] = colorize_point(row[j]);
+    }
+}
+
+color colorize_point(const point_data@ p) {
+
+    if (p.diverged) {
+        double smoothed_count = p.smooth_iterations;
+
+        double fraction = cdf(smoothed_count);
+
+        double hue = (4.0/6.0) * (1.0 - fraction);
+        if (hue < 0.0) hue += 1.0;
+
+        double value = 1.0;
+        if (smoothed_count < dark_below) {
+            value = 0.3;
+        }
+
+        return hsv(hue, 1.0, value);
+    } else {
+        return black();
+    }
+}
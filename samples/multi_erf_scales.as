@@ -128,25 +128,29 @@ void setup(meta_data p, args@ a) {
 }
 
 
-// Compute a histogram. Not sure what we'll do with it but lets just see
-// it. 
-//
+// Fill the histogram buckets from the iteration counts the colorator
+// already has. No prepass over every point is needed.
 //
 int total_diverged;
 
-void prepass(point_data@ r) {
-    if (r.diverged) {
-        total_diverged += 1;
-        int scaled = r.iterations-min_iter;
+void fill_buckets() {
+    total_diverged = int(diverged_count());
+
+    for (int iterations = min_iter; iterations <= max_iter; ++iterations) {
+        int count = int(histogram(iterations));
+        if (count == 0) {
+            continue;
+        }
+
+        int scaled = iterations-min_iter;
         int bucket_index = scaled / int(bucket_size+1);
         for (int i = bucket_index; i < BUCKET_COUNT; ++i) {
             if (buckets[i].limit > scaled) {
-                buckets[i].count += 1;
+                buckets[i].count += count;
                 break;
             }
         }
     }
-
 }
 
 // ---------------------------------------------------------
@@ -194,6 +198,8 @@ erf_scale_item compute_erf_scale(int start_bucket, int total, int count_offset)
 
 
 void precolor() {
+    fill_buckets();
+
     logger ("erf(0.5) = " + erf(0.5) + "\n");
     logger ("erf(1.0) = " + erf(1.0) + "\n");
     logger ("erf(2.0) = " + erf(2.0) + "\n");
@@ -317,16 +323,12 @@ double compute_value(double x) {
 
 // ---------------------------------------------------------
 // Lets color things!
+//
+// colorize() only reads the globals, so it is safe for the colorator
+// to call it for several points at once.
 // ---------------------------------------------------------
-int row = 0;
-int column = -1;
-color colorize(point_data@ r) {
-
-    column += 1;
-    if ( column >= total_columns) {
-        column = 0;
-        row += 1;
-    }
+[parallel]
+color colorize(point_data@ r, int row, int column) {
 
     if ( config.show_mid_point && 
             row < mid_row_count+1 && row > mid_row_count -1 && 
@@ -0,0 +1,97 @@
+/*
+ * A sample colorizer plugin (see src/include/colorizer_plugin.h).
+ *
+ * The prepass finds the mean smoothed count of the diverged points and
+ * precolor uses it to scale a cosine palette, so that the mean lands
+ * `cycles` times around. Colorize only reads the state, so it is marked
+ * parallel.
+ *
+ * Build and use:
+ *
+ *  cc -O2 -shared -fPIC -I src/include -o cosine_palette.so samples/plugins/cosine_palette.c -lm
+ *  build/colorator -i sample.fract -o sample.bmp --colorizer plugin:./cosine_palette.so --args 'cycles=2;'
+ */
+#include "colorizer_plugin.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct state {
+    double cycles;
+    double sum;
+    int64_t count;
+    double scale;
+};
+
+static void *create(const mandel_meta_data *meta, const mandel_arg *args, int32_t arg_count) {
+    struct state *s = calloc(1, sizeof(struct state));
+    if (s == NULL)
+        return NULL;
+
+    s->cycles = 1.0;
+    for (int32_t i = 0; i < arg_count; ++i) {
+        if (strcmp(args[i].key, "cycles") == 0)
+            s->cycles = atof(args[i].value);
+    }
+    (void)meta;
+    return s;
+}
+
+static void destroy(void *state) {
+    free(state);
+}
+
+static int32_t prepass(void *state, int32_t row, const mandel_point *points, int32_t count) {
+    struct state *s = state;
+    (void)row;
+    for (int32_t j = 0; j < count; ++j) {
+        if (points[j].diverged) {
+            s->sum += points[j].smooth_iterations;
+            s->count += 1;
+        }
+    }
+    return 0;
+}
+
+static int32_t precolor(void *state) {
+    struct state *s = state;
+    double mean = (s->count > 0) ? s->sum / (double)s->count : 1.0;
+    s->scale = s->cycles / mean;
+    return 0;
+}
+
+static uint8_t channel(double t, double phase) {
+    return (uint8_t)(127.5 + 127.5 * cos(6.283185307179586 * (t + phase)));
+}
+
+static int32_t colorize(void *state, int32_t row, const mandel_point *points,
+        int32_t count, mandel_pixel *pixels) {
+    const struct state *s = state;
+    (void)row;
+    for (int32_t j = 0; j < count; ++j) {
+        if (points[j].diverged) {
+            double t = points[j].smooth_iterations * s->scale;
+            pixels[j].red   = channel(t, 0.0);
+            pixels[j].green = channel(t, 0.1);
+            pixels[j].blue  = channel(t, 0.2);
+        } else {
+            pixels[j].red = pixels[j].green = pixels[j].blue = 0;
+        }
+    }
+    return 0;
+}
+
+static const mandel_colorizer plugin = {
+    MANDEL_COLORIZER_ABI_VERSION,
+    MANDEL_COLORIZER_PARALLEL,
+    create,
+    destroy,
+    prepass,
+    precolor,
+    colorize,
+};
+
+const mandel_colorizer *mandel_colorizer_entry(void) {
+    return &plugin;
+}
@@ -0,0 +1,303 @@
+#include "builtin_colorizers.hpp"
+
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+// ---------------------------------------------------------------------
+// smooth-hsv - samples/algo2.as
+//
+// Starting at blue, go around the color wheel `cycles` times as the log of
+// the smoothed count goes from the lowest to the highest count. The value
+// follows the log of the count.
+// ---------------------------------------------------------------------
+class smooth_hsv_colorizer : public native_colorizer {
+    double cycles_ = 3.0;
+    int min_iter_ = 0;
+    double log_range_ = 0.0;
+
+  public:
+    void setup(fractal_meta_data const &params, fractal_stats const &,
+            color_args const &args) override {
+        cycles_ = arg_double(args, "cycles", 3.0);
+        min_iter_ = params.min_iterations;
+        log_range_ = std::log(double(params.max_iterations - min_iter_ + 1));
+    }
+
+    void colorize_row(int, std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels) const override {
+        pixels.resize(points.size());
+        for (std::size_t j = 0; j < points.size(); ++j) {
+            auto const &p = points[j];
+            if (not p.diverged) {
+                pixels[j] = pixel(0, 0, 0);
+                continue;
+            }
+
+            double smoothed_count = double(p.iterations - min_iter_ + 1) + p.fraction;
+            double log_limited_count = 0.0;
+            if (smoothed_count >= 1.0 and log_range_ > 0.0)
+                log_limited_count = std::log(smoothed_count) / log_range_;
+
+            double hue = (4.0f/6.0f) * (1.0 - cycles_ * log_limited_count);
+            while (hue < 0.0) hue += 1.0;
+
+            pixels[j] = pixel(hue, 1.0, log_limited_count);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------
+// histogram - samples/histogram.as
+//
+// Histogram equalization of the smoothed count, going around the color
+// wheel from blue. The fastest escaping dark_percentile of the points are
+// drawn dark.
+// ---------------------------------------------------------------------
+class histogram_colorizer : public native_colorizer {
+    iteration_cdf cdf_;
+    double dark_below_ = 0.0;
+
+  public:
+    void setup(fractal_meta_data const &, fractal_stats const &stats,
+            color_args const &args) override {
+        cdf_ = iteration_cdf(stats);
+        dark_below_ = cdf_.percentile(arg_double(args, "dark_percentile", 0.0));
+    }
+
+    bool needs_stats() const override { return true; }
+
+    void colorize_row(int, std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels) const override {
+        pixels.resize(points.size());
+        for (std::size_t j = 0; j < points.size(); ++j) {
+            auto const &p = points[j];
+            if (not p.diverged) {
+                pixels[j] = pixel(0, 0, 0);
+                continue;
+            }
+
+            double hue = (4.0/6.0) * (1.0 - cdf_.cdf(p.smooth_iterations));
+            if (hue < 0.0) hue += 1.0;
+
+            double value = (p.smooth_iterations < dark_below_) ? 0.3 : 1.0;
+
+            pixels[j] = pixel(hue, 1.0, value);
+        }
+    }
+};
+
+// ---------------------------------------------------------------------
+// multi-erf - samples/multi_erf_scales.as
+//
+// The scaled smoothed count is shaped with erf(), scaled so that the
+// median point lands halfway round to green. Where that runs out of
+// range a second scale takes over for the slower points. The value is a
+// piecewise linear function of the result. A white cross is drawn at the
+// center unless show_mid_point=false.
+// ---------------------------------------------------------------------
+class multi_erf_colorizer : public native_colorizer {
+    static const int BUCKET_COUNT = 100;
+
+    struct erf_scale {
+        int threshold = -1;
+        int bucket_index = -1;
+        double scale = -100;
+        int offset = -1;
+    };
+
+    bool show_mid_point_ = true;
+    int min_iter_ = 0;
+    int shifted_max_iter_ = 1;
+    int mid_row_ = 0;
+    int mid_column_ = 0;
+    std::vector<erf_scale> scales_;
+
+    // histogram buckets
+    std::vector<double> limits_;
+    std::vector<std::int64_t> cumulative_;
+
+    double scaled_count(int iterations, double fraction) const {
+        return (double(iterations - min_iter_ + 1) + fraction) / double(shifted_max_iter_);
+    }
+
+    // The scale that brings the median of the points from start_bucket on
+    // to erf(1/2).
+    erf_scale find_scale(int start_bucket, std::int64_t total, std::int64_t count_offset) const {
+        for (int i = start_bucket; i < BUCKET_COUNT; ++i) {
+            if (cumulative_[i] - count_offset >= total / 2) {
+                erf_scale retval;
+                retval.scale = 1.0 / (2.0 * scaled_count(int(limits_[i]) + min_iter_, 0.0));
+                retval.bucket_index = i;
+                retval.offset = (start_bucket == 0) ? 0 : int(limits_[i-1]);
+                return retval;
+            }
+        }
+        return erf_scale{};
+    }
+
+    // Piecewise linear - rises from 0 to 1 at PEAK with a knee at
+    // LEFT_KNEE, then falls to LOW at 1.
+    static double compute_value(double x) {
+        const double PEAK = 0.7;
+        const double LEFT_KNEE = 0.5;
+        const double KNEE_SLOPE = 0.5;
+        const double LOW = 0.2;
+
+        const double KNEE = LEFT_KNEE * KNEE_SLOPE;
+        if (x > PEAK)
+            return 1 + (PEAK - x) * ((1.0 - LOW) / (1.0 - PEAK));
+        if (x < LEFT_KNEE)
+            return x * KNEE_SLOPE;
+        return KNEE + (x - LEFT_KNEE) * ((1.0 - KNEE) / (PEAK - LEFT_KNEE));
+    }
+
+    bool on_mid_point(int row, int column) const {
+        return show_mid_point_ and (
+                (row == mid_row_ and std::abs(column - mid_column_) < 7) or
+                (column == mid_column_ and std::abs(row - mid_row_) < 7));
+    }
+
+  public:
+    void setup(fractal_meta_data const &params, fractal_stats const &stats,
+            color_args const &args) override {
+        show_mid_point_ = arg_bool(args, "show_mid_point", true);
+
+        min_iter_ = params.min_iterations;
+        int max_iter = params.max_iterations;
+        shifted_max_iter_ = max_iter - min_iter_ + 1;
+        mid_row_ = params.samples_img / 2;
+        mid_column_ = params.samples_real / 2;
+
+        double bucket_size = double(max_iter - min_iter_) / double(BUCKET_COUNT);
+        limits_.resize(BUCKET_COUNT);
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            limits_[i] = bucket_size * (i+1);
+        }
+
+        auto counts = std::vector<std::int64_t>(BUCKET_COUNT);
+        for (int iterations = min_iter_; iterations <= max_iter; ++iterations) {
+            auto count = stats.count(iterations);
+            if (count == 0)
+                continue;
+
+            int scaled = iterations - min_iter_;
+            for (int i = scaled / int(bucket_size + 1); i < BUCKET_COUNT; ++i) {
+                if (limits_[i] > scaled) {
+                    counts[i] += count;
+                    break;
+                }
+            }
+        }
+
+        cumulative_.resize(BUCKET_COUNT);
+        std::int64_t bucket_total = 0;
+        for (int i = 0; i < BUCKET_COUNT; ++i) {
+            bucket_total += counts[i];
+            cumulative_[i] = bucket_total;
+        }
+
+        scales_.clear();
+        auto first = find_scale(0, bucket_total, 0);
+        if (first.bucket_index < 0) {
+            // nothing diverged
+            return;
+        }
+        scales_.push_back(first);
+
+        // Where the first scale pushes erf() past 2, start over with the
+        // rest of the points.
+        for (int i = std::max(first.bucket_index, 1); i < BUCKET_COUNT; ++i) {
+            double scaled = scaled_count(int(limits_[i]) + min_iter_, 0.0);
+            if ((scaled - first.offset) * first.scale > 2.0) {
+                auto second = find_scale(i,
+                        std::int64_t(double(stats.diverged_count) - limits_[i-1]),
+                        int(limits_[i-1]));
+                if (second.bucket_index >= 0) {
+                    scales_.back().threshold = int(limits_[i]);
+                    scales_.push_back(second);
+                }
+                break;
+            }
+        }
+        scales_.back().threshold = params.limit + 1;
+
+        for (auto const &s : scales_) {
+            std::cerr << "erf scale = " << s.scale << " offset = " << s.offset
+                << " threshold = " << s.threshold << "\n";
+        }
+    }
+
+    bool needs_stats() const override { return true; }
+
+    void colorize_row(int row, std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels) const override {
+        pixels.resize(points.size());
+        for (std::size_t j = 0; j < points.size(); ++j) {
+            auto const &p = points[j];
+            if (on_mid_point(row, int(j))) {
+                pixels[j] = pixel(255, 255, 255);
+                continue;
+            }
+            if (not p.diverged) {
+                pixels[j] = pixel(0, 0, 0);
+                continue;
+            }
+
+            erf_scale const *s = nullptr;
+            for (auto const &candidate : scales_) {
+                if (p.iterations - min_iter_ + 1 < candidate.threshold) {
+                    s = &candidate;
+                    break;
+                }
+            }
+            if (not s) {
+                pixels[j] = pixel(255, 255, 255);
+                continue;
+            }
+
+            double shaped = std::erf(scaled_count(p.iterations - s->offset, p.fraction) * s->scale);
+            double hue = (4.0f/6.0f) * (1.0 - shaped);
+            if (hue < 0.0) hue += 1.0;
+
+            pixels[j] = pixel(hue, 1.0, compute_value(shaped));
+        }
+    }
+};
+
+struct builtin_entry {
+    char const *name;
+    std::function<std::unique_ptr<native_colorizer>()> make;
+};
+
+const builtin_entry builtins[] = {
+    { "smooth-hsv", []() { return std::make_unique<smooth_hsv_colorizer>(); } },
+    { "histogram",  []() { return std::make_unique<histogram_colorizer>(); } },
+    { "multi-erf",  []() { return std::make_unique<multi_erf_colorizer>(); } },
+};
+
+} // namespace
+
+std::unique_ptr<native_colorizer> make_builtin_colorizer(std::string const &name) {
+    for (auto const &b : builtins) {
+        if (name == b.name)
+            return b.make();
+    }
+
+    std::string known;
+    for (auto const &n : builtin_colorizer_names()) {
+        known += (known.empty() ? "" : ", ") + n;
+    }
+    throw std::runtime_error("Unknown builtin colorizer '" + name + "' (known: " + known + ")");
+}
+
+std::vector<std::string> builtin_colorizer_names() {
+    std::vector<std::string> names;
+    for (auto const &b : builtins) {
+        names.push_back(b.name);
+    }
+    return names;
+}
@@ -0,0 +1,20 @@
+#if !defined(MANDEL_BUILTIN_COLORIZERS_HPP_)
+#define MANDEL_BUILTIN_COLORIZERS_HPP_
+
+#include "native_colorizer.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// The coloring algorithms compiled into the colorator, for the styles
+// that are used often enough not to pay for the script engine.
+
+// name is the part of --colorizer after "builtin:". Throws
+// std::runtime_error for unknown names.
+std::unique_ptr<native_colorizer> make_builtin_colorizer(std::string const &name);
+
+// For help and error messages
+std::vector<std::string> builtin_colorizer_names();
+
+#endif
@@ -0,0 +1,89 @@
+#include "color_args.hpp"
+
+#include <charconv>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+
+color_args parse_color_args(std::string const &arg_string) {
+
+    color_args kvp;
+
+    std::string_view sv(arg_string);
+
+    char current_delim = '=';
+    std::string_view current_key;
+    while(true) {
+        auto pos = sv.find_first_of(";=");
+
+        if (pos == std::string_view::npos) {
+            if (sv.size() > 0) {
+                if (current_delim == ';') {
+                    // we saw a key, so use what is left as the value.
+                    kvp.emplace(current_key, sv);
+                } else {
+                    throw std::runtime_error("Invalid args specified - key with no value");
+                }
+            }
+            break;
+
+        } else if (sv[pos] != current_delim) {
+            throw std::runtime_error(std::string("Invalid args specified - looking for ") + current_delim);
+        }
+
+        if (current_delim == '=') {
+            current_key = sv.substr(0, pos);
+            sv.remove_prefix(pos+1);
+            current_delim = ';';
+        } else {
+            auto value = sv.substr(0, pos);
+            sv.remove_prefix(pos+1);
+            kvp.emplace(current_key, value);
+            current_delim = '=';
+        }
+    }
+
+    return kvp;
+}
+
+double arg_double(color_args const &args, std::string const &key, double dflt) {
+    auto iter = args.find(key);
+    if (iter == args.end())
+        return dflt;
+
+    try {
+        size_t end;
+        double value = std::stod(iter->second, &end);
+        if (end == iter->second.size())
+            return value;
+    } catch (std::logic_error &) {
+    }
+
+    std::cerr << "Could not convert string '" << iter->second
+            << "' to a double for argument " << key << "\n";
+    throw std::runtime_error("Double conversion error for argument");
+}
+
+int arg_int(color_args const &args, std::string const &key, int dflt) {
+    auto iter = args.find(key);
+    if (iter == args.end())
+        return dflt;
+
+    int value = 0;
+    auto end_ptr = iter->second.data() + iter->second.size();
+    auto result = std::from_chars(iter->second.data(), end_ptr, value);
+    if (result.ec != std::errc{} or result.ptr != end_ptr) {
+        std::cerr << "Could not convert string '" << iter->second
+                << "' to an integer for argument " << key << "\n";
+        throw std::runtime_error("Integer conversion error for argument");
+    }
+    return value;
+}
+
+bool arg_bool(color_args const &args, std::string const &key, bool dflt) {
+    auto iter = args.find(key);
+    if (iter == args.end())
+        return dflt;
+
+    return (iter->second == "true" or iter->second == "1");
+}
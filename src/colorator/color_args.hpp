@@ -0,0 +1,19 @@
+#if !defined(MANDEL_COLOR_ARGS_HPP_)
+#define MANDEL_COLOR_ARGS_HPP_
+
+#include <map>
+#include <string>
+
+// The key/value pairs given with --args, e.g. "period=16;dark=true;"
+using color_args = std::map<std::string, std::string>;
+
+// Throws std::runtime_error if the string is malformed.
+color_args parse_color_args(std::string const &arg_string);
+
+// The value of key, or dflt if it is not given. Throw std::runtime_error
+// if the value does not convert.
+double arg_double(color_args const &args, std::string const &key, double dflt);
+int    arg_int(color_args const &args, std::string const &key, int dflt);
+bool   arg_bool(color_args const &args, std::string const &key, bool dflt);
+
+#endif
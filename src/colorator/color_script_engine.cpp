@@ -1,7 +1,13 @@
 #include "color_script_engine.hpp"
 
 #include "pixel.hpp"
+#include "gradient.hpp"
+#include "color_args.hpp"
 
+#include <scriptarray/scriptarray.h>
+
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <cassert>
 #include <cstring>
@@ -13,19 +19,85 @@
 ColorScriptEngine::~ColorScriptEngine() {
     if (color_func_) color_func_->Release();
     if (prepass_func_) prepass_func_->Release();
+    if (color_row_func_) color_row_func_->Release();
+    if (prepass_row_func_) prepass_row_func_->Release();
+    if (row_points_) row_points_->Release();
+    if (state_prepass_func_) state_prepass_func_->Release();
+    if (state_prepass_row_func_) state_prepass_row_func_->Release();
+    if (state_merge_func_) state_merge_func_->Release();
 }
 
 bool ColorScriptEngine::has_prepass() {
-    if (checked_prepass) {
-        return prepass_func_ != nullptr;
+    find_row_funcs();
+
+    if (not checked_prepass) {
+        prepass_func_ = find_function("void prepass(point_data@)");
+        checked_prepass = true;
+        if (prepass_func_)
+            prepass_func_->AddRef();
     }
 
-    prepass_func_ = find_function("void prepass(point_data@)");
-    checked_prepass = true;
-    if (prepass_func_)
-        prepass_func_->AddRef();
+    return prepass_func_ != nullptr or prepass_row_func_ != nullptr or
+        has_parallel_prepass();
+}
+
+bool ColorScriptEngine::has_parallel_prepass() {
+    find_state_funcs();
+    return state_prepass_func_ != nullptr or state_prepass_row_func_ != nullptr;
+}
+
+void ColorScriptEngine::find_state_funcs() {
+    if (checked_state_funcs) return;
+    checked_state_funcs = true;
+
+    state_type_ = get_module()->GetTypeInfoByDecl("prepass_state");
+    if (not state_type_) return;
+
+    state_prepass_row_func_ = find_function(
+            "void prepass_row(const point_data[]@, prepass_state@)");
+    if (state_prepass_row_func_)
+        state_prepass_row_func_->AddRef();
+
+    state_prepass_func_ = find_function("void prepass(point_data@, prepass_state@)");
+    if (state_prepass_func_)
+        state_prepass_func_->AddRef();
+
+    if (not state_prepass_func_ and not state_prepass_row_func_)
+        return;
+
+    state_merge_func_ = state_type_->GetMethodByDecl("void merge(prepass_state@)");
+    if (not state_merge_func_)
+        throw std::runtime_error("prepass_state has no merge(prepass_state@) method");
+    state_merge_func_->AddRef();
+}
 
-    return prepass_func_ != nullptr;
+std::unique_ptr<ColorScriptEngine::Prepasser> ColorScriptEngine::make_prepasser() {
+    if (not has_parallel_prepass())
+        throw std::runtime_error("Script has no prepass(point_data@, prepass_state@)");
+    return std::make_unique<Prepasser>(*this);
+}
+
+void ColorScriptEngine::call_precolor(std::vector<std::unique_ptr<Prepasser>> const &parts) {
+    void *state = parts.front()->state_;
+
+    for (std::size_t w = 1; w < parts.size(); ++w) {
+        auto ctx = prepare_context(state_merge_func_);
+        ctx->SetObject(state);
+        ctx->SetArgObject(0, parts[w]->state_);
+        if (not execute_context())
+            throw std::runtime_error("Call to prepass_state.merge() failed");
+    }
+
+    auto *precolor_func = find_function("void precolor(prepass_state@)");
+    if (not precolor_func) {
+        call_precolor();
+        return;
+    }
+
+    auto ctx = prepare_context(precolor_func);
+    ctx->SetArgObject(0, state);
+    if (not execute_context())
+        throw std::runtime_error("Call to precolor() failed");
 }
 
 void ColorScriptEngine::call_precolor() {
@@ -75,6 +147,74 @@ struct script_point_data : public fractal_point_data {
     }
 };
 
+point_arg::~point_arg() {
+    if (point_) point_->Release();
+}
+
+script_point_data *point_arg::set(fractal_point_data const &pd) {
+    if (point_ and point_->refcnt > 1) {
+        point_->Release();
+        point_ = nullptr;
+    }
+
+    if (point_) {
+        static_cast<fractal_point_data &>(*point_) = pd;
+    } else {
+        point_ = new script_point_data(pd);
+    }
+
+    return point_;
+}
+
+bool script_meta_has_distance(fractal_meta_data *md) {
+    return md->has_channel(channel_id::distance);
+}
+
+// point_data.trap(i) - bounds checked access to the orbit trap values
+double script_point_trap(int index, script_point_data *pd) {
+    if (index < 0 or index >= MAX_TRAPS) {
+        asGetActiveContext()->SetException("trap index out of range");
+        return 0.0;
+    }
+
+    return pd->traps[index];
+}
+
+// The script's gradient. The count is atomic since a gradient set up in
+// setup() is used by [parallel] colorize functions on several threads.
+struct script_gradient : public gradient {
+    std::atomic<int> refcnt{1};
+
+    static script_gradient *Create() {
+        return new script_gradient();
+    }
+
+    void Release() {
+        if (--refcnt <= 0)
+            delete this;
+    }
+
+    void AddRef() {
+        ++refcnt;
+    }
+};
+
+void script_gradient_add_stop(double t, pixel const &color, script_gradient *g) {
+    g->add_stop(t, color);
+}
+
+pixel script_gradient_at(double t, script_gradient *g) {
+    return g->at(t);
+}
+
+pixel script_gradient_cycle(double t, script_gradient *g) {
+    return g->cycle(t);
+}
+
+int script_gradient_stop_count(script_gradient *g) {
+    return g->stop_count();
+}
+
 pixel script_white() {
     return pixel(255,255,255);
 }
@@ -87,6 +227,11 @@ pixel script_hsv(double h, double s, double v) {
     return pixel(h,s,v);
 }
 
+pixel script_rgb(int r, int g, int b) {
+    // note the order pixel takes them in
+    return pixel(r, b, g);
+}
+
 double script_fmod(double a, double b) {
     // shim to make sure the compiler
     // gets the correct version
@@ -112,42 +257,7 @@ struct parse {
 
 void* ColorScriptEngine::parse_args(std::string arg_string) {
 
-    std::map<std::string_view, std::string_view> kvp;
-
-    std::string_view sv(arg_string);
-
-    char current_delim = '=';
-    std::string_view current_key;
-    while(true) {
-        std::cerr << "current delim = '" << current_delim << "'\n";
-        auto pos = sv.find_first_of(";=");
-
-        if (pos == std::string_view::npos) {
-            if (sv.size() > 0) {
-                if (current_delim == ';') {
-                    // we saw a key, so use what is left as the value.
-                    kvp.emplace(current_key, sv);
-                } else {
-                    throw std::runtime_error("Invalid args specified - key with no value");
-                }
-            }
-            break;
-
-        } else if (sv[pos] != current_delim) {
-            throw std::runtime_error("Invalid args specified - looking for " + current_delim);
-        }
-
-        if (current_delim == '=') {
-            current_key = sv.substr(0, pos);
-            sv.remove_prefix(pos+1);
-            current_delim = ';';
-        } else {
-            auto value = sv.substr(0, pos);
-            sv.remove_prefix(pos+1);
-            kvp.emplace(current_key, value);
-            current_delim = '=';
-        }
-    }
+    auto kvp = parse_color_args(arg_string);
 
     for (auto const& [key, value] : kvp) {
         std::cerr << key << " => " << value << "\n";
@@ -258,6 +368,7 @@ void* ColorScriptEngine::parse_args(std::string arg_string) {
 
 bool ColorScriptEngine::call_setup(fractal_meta_data *fp, std::string arg_string) {
 
+    escape_radius_ = fp->escape_radius;
 
     bool has_args = true;
     auto *setup_func = find_function("void setup(meta_data,args@)");
@@ -293,41 +404,301 @@ bool ColorScriptEngine::call_setup(fractal_meta_data *fp, std::string arg_string
     }
 }
 
-pixel ColorScriptEngine::call_colorize(fractal_point_data &pd) {
-    if (not color_func_) {
+void ColorScriptEngine::call_prepass(fractal_point_data const &pd) {
+    if (not has_prepass() or not prepass_func_) return;
+
+    auto ctx = prepare_context(prepass_func_);
+    ctx->SetArgObject(0, point_.set(pd));
+    if ( not execute_context() ) {
+        throw std::runtime_error("Call to prepass() failed");
+    }
+}
+
+void ColorScriptEngine::find_row_funcs() {
+    if (checked_row_funcs) return;
+    checked_row_funcs = true;
+
+    prepass_row_func_ = find_function("void prepass_row(const point_data[]@)");
+    if (prepass_row_func_) {
+        prepass_row_func_->AddRef();
+        row_points_ = make_point_array();
+    }
+}
+
+// Look for the colorize functions, preferring the row version and the
+// versions that are told where the point is.
+void ColorScriptEngine::find_color_funcs() {
+    if (color_func_ or color_row_func_) return;
+
+    color_row_func_ = find_function(
+            "void colorize_row(const point_data[]@, color[]@, int)");
+    color_row_func_at_ = (color_row_func_ != nullptr);
+    if (not color_row_func_)
+        color_row_func_ = find_function(
+                "void colorize_row(const point_data[]@, color[]@)");
+
+    if (color_row_func_) {
+        // we are storing so be sure to take a reference
+        color_row_func_->AddRef();
+        return;
+    }
+
+    color_func_ = find_function("color colorize(point_data@, int, int)");
+    color_func_at_ = (color_func_ != nullptr);
+    if (not color_func_)
         color_func_ = find_function("color colorize(point_data@)");
-        if (color_func_) {
-            // we are storing so be sure to take a reference
-            color_func_->AddRef();
-        } else {
-            throw std::runtime_error("Could not find colorize() function");
+
+    if (color_func_) {
+        color_func_->AddRef();
+    } else {
+        throw std::runtime_error("Could not find colorize() function");
+    }
+
+    color_pure_ = has_metadata(color_func_, "pure");
+    if (color_pure_ and color_func_at_) {
+        std::cerr << "colorize() is given the row and column, ignoring [pure]\n";
+        color_pure_ = false;
+    }
+}
+
+bool ColorScriptEngine::colorize_is_parallel() {
+    find_color_funcs();
+    return colorize_is_pure() or
+        has_metadata(color_row_func_ ? color_row_func_ : color_func_, "parallel");
+}
+
+bool ColorScriptEngine::colorize_is_pure() {
+    find_color_funcs();
+    return color_pure_;
+}
+
+// Looks through the bytecode of the script's functions (and its classes'
+// methods) for calls to the stats functions.
+bool ColorScriptEngine::uses_stats() {
+    auto calls_stats = [this](asIScriptFunction const *func) {
+        if (not func)
+            return false;
+        asUINT length = 0;
+        asDWORD *bc = const_cast<asIScriptFunction *>(func)->GetByteCode(&length);
+        for (asUINT pos = 0; bc and pos < length; ) {
+            asDWORD *instr = bc + pos;
+            auto op = *reinterpret_cast<asBYTE *>(instr);
+            if (op == asBC_CALLSYS and std::find(stats_func_ids_.begin(),
+                        stats_func_ids_.end(), asBC_INTARG(instr)) != stats_func_ids_.end())
+                return true;
+            pos += asBCTypeSize[asBCInfo[op].type];
         }
+        return false;
+    };
+
+    auto *module = get_module();
+    for (asUINT i = 0; i < module->GetFunctionCount(); ++i) {
+        if (calls_stats(module->GetFunctionByIndex(i)))
+            return true;
+    }
+    for (asUINT t = 0; t < module->GetObjectTypeCount(); ++t) {
+        auto *type = module->GetObjectTypeByIndex(t);
+        for (asUINT i = 0; i < type->GetMethodCount(); ++i) {
+            if (calls_stats(type->GetMethodByIndex(i, false)))
+                return true;
+        }
+        for (asUINT i = 0; i < type->GetBehaviourCount(); ++i) {
+            if (calls_stats(type->GetBehaviourByIndex(i, nullptr)))
+                return true;
+        }
+        for (asUINT i = 0; i < type->GetFactoryCount(); ++i) {
+            if (calls_stats(type->GetFactoryByIndex(i)))
+                return true;
+        }
+    }
+    return false;
+}
+
+std::unique_ptr<ColorScriptEngine::Colorizer> ColorScriptEngine::make_colorizer() {
+    find_color_funcs();
+    return std::make_unique<Colorizer>(*this);
+}
+
+CScriptArray *ColorScriptEngine::make_point_array() {
+    return CScriptArray::Create(engine_->GetTypeInfoByDecl("array<point_data>"));
+}
+
+// Copy the points into the (reused) script array. The array only
+// allocates when it grows, so this is one allocation per point for the
+// first row and none after that.
+void load_row_points(CScriptArray *row_points, std::vector<fractal_point_data> const &points) {
+    if (row_points->GetSize() != points.size())
+        row_points->Resize(points.size());
+
+    for (unsigned j = 0; j < points.size(); ++j) {
+        auto *spd = static_cast<script_point_data *>(row_points->At(j));
+        static_cast<fractal_point_data &>(*spd) = points[j];
+    }
+}
+
+ColorScriptEngine::Colorizer::Colorizer(ColorScriptEngine &se) : se_(se) {
+    ctx_ = se_.engine_->CreateContext();
+
+    if (se_.color_row_func_) {
+        row_points_ = se_.make_point_array();
+        row_colors_ = CScriptArray::Create(
+                se_.engine_->GetTypeInfoByDecl("array<color>"));
+    }
+}
+
+ColorScriptEngine::Colorizer::~Colorizer() {
+    if (row_points_) row_points_->Release();
+    if (row_colors_) row_colors_->Release();
+    ctx_->Release();
+}
+
+void ColorScriptEngine::Colorizer::colorize_row(int row,
+        std::vector<fractal_point_data> const &points, std::vector<pixel> &pixels) {
+
+    pixels.clear();
+
+    if (se_.color_pure_) {
+        for (auto const &pd : points)
+            pixels.push_back(colorize_pure(pd));
+        return;
+    }
+
+    if (not se_.color_row_func_) {
+        for (unsigned j = 0; j < points.size(); ++j)
+            pixels.push_back(colorize(row, j, points[j]));
+        return;
     }
 
-    script_point_data *r = new script_point_data(pd);
+    load_row_points(row_points_, points);
+    row_colors_->Resize(points.size());
+    script_calls_ += 1;
+
+    ctx_->Prepare(se_.color_row_func_);
+    ctx_->SetArgObject(0, row_points_);
+    ctx_->SetArgObject(1, row_colors_);
+    if (se_.color_row_func_at_)
+        ctx_->SetArgDWord(2, row);
+
+    if (not se_.execute_context(ctx_))
+        throw std::runtime_error("colorize_row call failed");
+
+    if (row_colors_->GetSize() != points.size())
+        throw std::runtime_error("colorize_row changed the size of the color array");
 
-    auto ctx = prepare_context(color_func_);
-    ctx->SetArgObject(0, r);
+    // Arrays of objects hold pointers, even for value types, so go through At().
+    for (unsigned j = 0; j < points.size(); ++j)
+        pixels.push_back(*static_cast<pixel const *>(row_colors_->At(j)));
+}
+
+pixel ColorScriptEngine::Colorizer::colorize(int row, int column,
+        fractal_point_data const &pd) {
+
+    script_calls_ += 1;
 
-    if (execute_context()) {
-        r->Release();
-        return *(pixel *)ctx->GetReturnObject();
+    ctx_->Prepare(se_.color_func_);
+    ctx_->SetArgObject(0, point_.set(pd));
+    if (se_.color_func_at_) {
+        ctx_->SetArgDWord(1, row);
+        ctx_->SetArgDWord(2, column);
+    }
+
+    if (se_.execute_context(ctx_)) {
+        return *(pixel *)ctx_->GetReturnObject();
     } else {
         throw std::runtime_error("colorize call failed");
     }
 }
 
-void ColorScriptEngine::call_prepass(fractal_point_data &pd) {
+// A pure colorize only sees the iterations, diverged and the smoothing
+// (fraction, smooth_iterations, last_modulus), with the fraction rounded to
+// one of PURE_FRACTION_STEPS values. So it is called once for each
+// combination and the color reused.
+const int PURE_FRACTION_STEPS = 1024;
+
+pixel ColorScriptEngine::Colorizer::colorize_pure(fractal_point_data const &pd) {
+    // fraction is on (-1, 0]
+    int step = 0;
+    if (pd.diverged) {
+        step = std::clamp(int(-pd.fraction * PURE_FRACTION_STEPS), 0,
+                PURE_FRACTION_STEPS - 1);
+    }
+
+    std::uint64_t key = (std::uint64_t(std::uint32_t(pd.iterations)) << 32) |
+        (std::uint64_t(step) << 1) | std::uint64_t(pd.diverged);
+
+    auto iter = memo_.find(key);
+    if (iter != memo_.end())
+        return iter->second;
+
+    fractal_point_data quantized;
+    quantized.iterations = pd.iterations;
+    quantized.diverged = pd.diverged;
+    if (pd.diverged) {
+        quantized.fraction = -(step + 0.5) / PURE_FRACTION_STEPS;
+        quantized.last_modulus = modulus_from_fraction(quantized.fraction, se_.escape_radius_);
+    }
+    quantized.smooth_iterations = quantized.iterations + quantized.fraction;
+
+    auto color = colorize(0, 0, quantized);
+    memo_.emplace(key, color);
+    return color;
+}
+
+void ColorScriptEngine::call_prepass_row(std::vector<fractal_point_data> const &points) {
     if (not has_prepass()) return;
 
-    script_point_data *r = new script_point_data(pd);
-    auto ctx = prepare_context(prepass_func_);
-    ctx->SetArgObject(0, r);
-    if ( execute_context() ) {
-        r->Release();
-    } else {
-        throw std::runtime_error("Call to prepass() failed");
+    if (not prepass_row_func_) {
+        for (auto const &pd : points)
+            call_prepass(pd);
+        return;
     }
+
+    load_row_points(row_points_, points);
+
+    prepare_context(prepass_row_func_);
+    context_->SetArgObject(0, row_points_);
+
+    if (not execute_context())
+        throw std::runtime_error("Call to prepass_row() failed");
+}
+
+ColorScriptEngine::Prepasser::Prepasser(ColorScriptEngine &se) : se_(se) {
+    ctx_ = se_.engine_->CreateContext();
+    state_ = se_.engine_->CreateScriptObject(se_.state_type_);
+    if (not state_)
+        throw std::runtime_error("Could not create a prepass_state");
+
+    if (se_.state_prepass_row_func_)
+        row_points_ = se_.make_point_array();
+}
+
+ColorScriptEngine::Prepasser::~Prepasser() {
+    if (row_points_) row_points_->Release();
+    se_.engine_->ReleaseScriptObject(state_, se_.state_type_);
+    ctx_->Release();
+}
+
+void ColorScriptEngine::Prepasser::prepass_row(std::vector<fractal_point_data> const &points) {
+    if (not se_.state_prepass_row_func_) {
+        for (auto const &pd : points) {
+            ctx_->Prepare(se_.state_prepass_func_);
+            ctx_->SetArgObject(0, point_.set(pd));
+            ctx_->SetArgObject(1, state_);
+
+            if (not se_.execute_context(ctx_))
+                throw std::runtime_error("Call to prepass() failed");
+        }
+        return;
+    }
+
+    load_row_points(row_points_, points);
+
+    ctx_->Prepare(se_.state_prepass_row_func_);
+    ctx_->SetArgObject(0, row_points_);
+    ctx_->SetArgObject(1, state_);
+
+    if (not se_.execute_context(ctx_))
+        throw std::runtime_error("Call to prepass_row() failed");
 }
 
 void ColorScriptEngine::_register_interface(asIScriptEngine * engine) {
@@ -372,12 +743,19 @@ void ColorScriptEngine::_register_interface(asIScriptEngine * engine) {
     r = engine->RegisterObjectProperty("meta_data", "int min_iterations",
             asOFFSET(fractal_meta_data,min_iterations));
     assert( r >= 0 );
+    r = engine->RegisterObjectMethod("meta_data", "bool get_has_distance() const property",
+            asFUNCTION(script_meta_has_distance), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
+    r = engine->RegisterObjectProperty("meta_data", "int trap_count",
+            asOFFSET(fractal_meta_data,trap_count));
+    assert( r >= 0 );
 
     // point_data
     r = engine->RegisterObjectType("point_data", 0, asOBJ_REF); 
     assert( r >= 0 );
 
-    // TODO: Maybe don't let script create?
+    // Scripts need the factory for point_data[] (and may make their own).
+    // The colorator does not allocate one per point, see point_arg.
     r = engine->RegisterObjectBehaviour("point_data", asBEHAVE_FACTORY, 
             "point_data@ f()", asFUNCTION(script_point_data::Create), asCALL_CDECL); 
     assert( r >= 0 );
@@ -401,6 +779,21 @@ void ColorScriptEngine::_register_interface(asIScriptEngine * engine) {
     r = engine->RegisterObjectProperty("point_data", "bool diverged",
             asOFFSET(script_point_data,diverged));
     assert( r >= 0 );
+    r = engine->RegisterObjectProperty("point_data", "double distance",
+            asOFFSET(script_point_data,distance));
+    assert( r >= 0 );
+    r = engine->RegisterObjectProperty("point_data", "int period",
+            asOFFSET(script_point_data,period));
+    assert( r >= 0 );
+    r = engine->RegisterObjectProperty("point_data", "double fraction",
+            asOFFSET(script_point_data,fraction));
+    assert( r >= 0 );
+    r = engine->RegisterObjectProperty("point_data", "double smooth_iterations",
+            asOFFSET(script_point_data,smooth_iterations));
+    assert( r >= 0 );
+    r = engine->RegisterObjectMethod("point_data", "double trap(int) const",
+            asFUNCTION(script_point_trap), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
 
     // color (pixel)
     std::cerr << "Register color (pixel)\n";
@@ -417,6 +810,35 @@ void ColorScriptEngine::_register_interface(asIScriptEngine * engine) {
     r = engine->RegisterGlobalFunction("color hsv(double, double, double)", 
             asFUNCTION(script_hsv), asCALL_CDECL); 
     assert( r >= 0 );
+    r = engine->RegisterGlobalFunction("color rgb(int, int, int)", 
+            asFUNCTION(script_rgb), asCALL_CDECL); 
+    assert( r >= 0 );
+
+    // gradient
+    std::cerr << "Register gradient\n";
+    r = engine->RegisterObjectType("gradient", 0, asOBJ_REF);
+    assert( r >= 0 );
+    r = engine->RegisterObjectBehaviour("gradient", asBEHAVE_FACTORY, 
+            "gradient@ f()", asFUNCTION(script_gradient::Create), asCALL_CDECL); 
+    assert( r >= 0 );
+    r = engine->RegisterObjectBehaviour("gradient", asBEHAVE_ADDREF, 
+            "void f()", asMETHOD(script_gradient,AddRef), asCALL_THISCALL); 
+    assert( r >= 0 );
+    r = engine->RegisterObjectBehaviour("gradient", asBEHAVE_RELEASE, 
+            "void f()", asMETHOD(script_gradient,Release), asCALL_THISCALL); 
+    assert( r >= 0 );
+    r = engine->RegisterObjectMethod("gradient", "void add_stop(double, const color &in)",
+            asFUNCTION(script_gradient_add_stop), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
+    r = engine->RegisterObjectMethod("gradient", "color at(double) const",
+            asFUNCTION(script_gradient_at), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
+    r = engine->RegisterObjectMethod("gradient", "color cycle(double) const",
+            asFUNCTION(script_gradient_cycle), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
+    r = engine->RegisterObjectMethod("gradient", "int stop_count() const",
+            asFUNCTION(script_gradient_stop_count), asCALL_CDECL_OBJLAST);
+    assert( r >= 0 );
 
     // other math
     r = engine->RegisterGlobalFunction("double fmod(double, double)",
@@ -429,4 +851,42 @@ void ColorScriptEngine::_register_interface(asIScriptEngine * engine) {
             asFUNCTION(script_log2), asCALL_CDECL);
     assert( r >= 0 );
 
+    // iteration stats
+    r = engine->RegisterGlobalFunction("int64 diverged_count()",
+            asMETHOD(ColorScriptEngine, script_diverged_count), 
+            asCALL_THISCALL_ASGLOBAL, this);
+    assert( r >= 0 );
+    stats_func_ids_.push_back(r);
+    r = engine->RegisterGlobalFunction("int64 histogram(int)",
+            asMETHOD(ColorScriptEngine, script_histogram), 
+            asCALL_THISCALL_ASGLOBAL, this);
+    assert( r >= 0 );
+    stats_func_ids_.push_back(r);
+    r = engine->RegisterGlobalFunction("double cdf(double)",
+            asMETHOD(ColorScriptEngine, script_cdf), 
+            asCALL_THISCALL_ASGLOBAL, this);
+    assert( r >= 0 );
+    stats_func_ids_.push_back(r);
+    r = engine->RegisterGlobalFunction("double percentile(double)",
+            asMETHOD(ColorScriptEngine, script_percentile), 
+            asCALL_THISCALL_ASGLOBAL, this);
+    assert( r >= 0 );
+    stats_func_ids_.push_back(r);
+
+}
+
+std::int64_t ColorScriptEngine::script_diverged_count() {
+    return stats_ ? stats_->diverged_count : 0;
+}
+
+std::int64_t ColorScriptEngine::script_histogram(int iterations) {
+    return stats_ ? stats_->count(iterations) : 0;
+}
+
+double ColorScriptEngine::script_cdf(double smoothed) {
+    return cdf_.cdf(smoothed);
+}
+
+double ColorScriptEngine::script_percentile(double p) {
+    return cdf_.percentile(p);
 }
@@ -5,29 +5,183 @@
 #include "pixel.hpp"
 #include "fractal_data.hpp"
 
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
+
+class CScriptArray;
+struct script_point_data;
+
+// The point_data handed to a script function. The same object is reused
+// from call to call, so there is no allocation per point, unless the
+// script kept a handle to it - then the next call gets a new one.
+class point_arg {
+    script_point_data *point_ = nullptr;
+  public:
+    point_arg() = default;
+    ~point_arg();
+
+    point_arg(point_arg const &) = delete;
+    point_arg &operator=(point_arg const &) = delete;
+
+    script_point_data *set(fractal_point_data const &pd);
+};
 
 class ColorScriptEngine: public ScriptEngine {
     asIScriptFunction* color_func_   = nullptr;
     asIScriptFunction* prepass_func_ = nullptr;
     bool checked_prepass = false;
 
+    // The row versions, if the script has them
+    asIScriptFunction* color_row_func_   = nullptr;
+    asIScriptFunction* prepass_row_func_ = nullptr;
+    bool checked_row_funcs = false;
+
+    // The colorize function is given the row (and column) of the point
+    bool color_func_at_     = false;
+    bool color_row_func_at_ = false;
+
+    // colorize is marked [pure] - its colors can be reused
+    bool color_pure_ = false;
+    double escape_radius_ = 0.0;
+
+    // Arguments for prepass and prepass_row. Reused from call to call.
+    point_arg point_;
+    CScriptArray* row_points_ = nullptr;
+
+    // The prepass versions that collect into a prepass_state, and how to
+    // merge those.
+    asITypeInfo* state_type_ = nullptr;
+    asIScriptFunction* state_prepass_func_     = nullptr;
+    asIScriptFunction* state_prepass_row_func_ = nullptr;
+    asIScriptFunction* state_merge_func_       = nullptr;
+    bool checked_state_funcs = false;
+
+    fractal_stats const *stats_ = nullptr;
+    iteration_cdf cdf_;
+    // ids of diverged_count, histogram, cdf and percentile
+    std::vector<int> stats_func_ids_;
+
     virtual void _register_interface(asIScriptEngine* engine) override; 
   public:
+    class Colorizer;
+    class Prepasser;
+
     ~ColorScriptEngine();
 
-    bool call_setup(fractal_meta_data *fp, std::string arg_string);
+    // What the stats functions report. Must outlive the engine.
+    void set_stats(fractal_stats const *stats) { 
+        stats_ = stats; 
+        cdf_ = iteration_cdf(*stats);
+    }
 
-    pixel call_colorize(fractal_point_data &results);
+    bool call_setup(fractal_meta_data *fp, std::string arg_string);
 
     bool has_prepass();
 
-    void call_prepass(fractal_point_data &results);
+    void call_prepass(fractal_point_data const &results);
+
+    // Call prepass_row() if the script has it, otherwise prepass() for
+    // each point.
+    void call_prepass_row(std::vector<fractal_point_data> const &points);
 
     void call_precolor();
 
+    // true if the script collects its prepass into a prepass_state, so
+    // that several prepassers can be run at once on different threads.
+    bool has_parallel_prepass();
+
+    // Throws if the script has no prepass_state.
+    std::unique_ptr<Prepasser> make_prepasser();
+
+    // Merge the states of the prepassers (in order) into the first and
+    // pass it to precolor.
+    void call_precolor(std::vector<std::unique_ptr<Prepasser>> const &parts);
+
+    // true if the script marked its colorize function [parallel] (or
+    // [pure]), i.e. several colorizers may be used at once on different
+    // threads.
+    bool colorize_is_parallel();
+
+    // true if the script marked its colorize function [pure], i.e. the
+    // color only depends on iterations, diverged and the smoothing.
+    bool colorize_is_pure();
+
+    // true if the script calls any of the stats functions (diverged_count,
+    // histogram, cdf or percentile) anywhere.
+    bool uses_stats();
+
+    // Throws if the script has no colorize function.
+    std::unique_ptr<Colorizer> make_colorizer();
+
   private:
+    void find_row_funcs();
+    void find_color_funcs();
+    void find_state_funcs();
+    CScriptArray *make_point_array();
+
     void* parse_args(std::string arg_string);
+
+    std::int64_t script_diverged_count();
+    std::int64_t script_histogram(int iterations);
+    double script_cdf(double smoothed);
+    double script_percentile(double p);
+};
+
+// Colors rows with its own script context.
+class ColorScriptEngine::Colorizer {
+    ColorScriptEngine &se_;
+    asIScriptContext *ctx_ = nullptr;
+    CScriptArray* row_points_ = nullptr;
+    CScriptArray* row_colors_ = nullptr;
+    point_arg point_;
+
+    // colors already computed by a pure colorize
+    std::unordered_map<std::uint64_t, pixel> memo_;
+    std::int64_t script_calls_ = 0;
+
+    pixel colorize(int row, int column, fractal_point_data const &pd);
+    pixel colorize_pure(fractal_point_data const &pd);
+
+  public:
+    explicit Colorizer(ColorScriptEngine &se);
+    ~Colorizer();
+
+    Colorizer(Colorizer const &) = delete;
+    Colorizer &operator=(Colorizer const &) = delete;
+
+    // Color a whole row with one call to colorize_row() if the script has
+    // it, otherwise with a call to colorize() per point.
+    void colorize_row(int row, std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels);
+
+    // number of times the script was called
+    std::int64_t script_calls() const { return script_calls_; }
+};
+
+// Runs the prepass with its own script context, collecting into its own
+// prepass_state.
+class ColorScriptEngine::Prepasser {
+    ColorScriptEngine &se_;
+    asIScriptContext *ctx_ = nullptr;
+    void *state_ = nullptr;
+    point_arg point_;
+    CScriptArray* row_points_ = nullptr;
+
+    friend class ColorScriptEngine;
+
+  public:
+    explicit Prepasser(ColorScriptEngine &se);
+    ~Prepasser();
+
+    Prepasser(Prepasser const &) = delete;
+    Prepasser &operator=(Prepasser const &) = delete;
+
+    // Call prepass_row() if the script has it, otherwise prepass() for
+    // each point.
+    void prepass_row(std::vector<fractal_point_data> const &points);
 };
 
 #endif
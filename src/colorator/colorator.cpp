@@ -1,67 +1,245 @@
 #include "colorator.hpp"
 
-#include "color_script_engine.hpp"
+#include "image_colorizer.hpp"
 
-#include "bmp_file.hpp"
+#include "image_file.hpp"
+#include "parallel_for.hpp"
 
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <fstream>
 
 
+// Rows each colorizer thread takes from a band before the band is written.
+const int ROWS_PER_WORKER = 16;
 
+using row_getter = std::function<std::shared_ptr<point_row>(int)>;
 
-void color_image(colorator_options const &clopts, FractalFile const &data) {
-    ColorScriptEngine se;
-    
-    auto params = data.get_meta_data();
+// Rows of a file opened with FractalFile::open_tiles(), read a tile at a
+// time as they are asked for. The tiles used last are kept, so that rows
+// near each other - a band, or each thread's share of a parallel prepass -
+// only cost one read per pass.
+class tile_cache {
+    FractalFile const &file_;
+    std::size_t capacity_;
+    std::mutex mtx_;
+    // most recently used first
+    std::list<std::pair<int, std::vector<std::shared_ptr<point_row>>>> tiles_;
 
-    std::cerr << "params.limit = " << params.limit << "\n";
-    
-    auto output_file = BMPFile{clopts.output_file, params.samples_img, 
-		params.samples_real};
+  public:
+    tile_cache(FractalFile const &file, int capacity) :
+        file_(file), capacity_(capacity) {}
+
+    std::shared_ptr<point_row> row(int i) {
+        int t = i / file_.rows_per_tile();
+        int r = i % file_.rows_per_tile();
+
+        {
+            std::lock_guard<std::mutex> l(mtx_);
+            auto found = find(t);
+            if (found != tiles_.end())
+                return found->second[r];
+        }
 
-    se.initialize(clopts.script_file);
+        // Read without the lock so that other threads can go on. Two
+        // threads may read the same tile, which is harmless.
+        auto rows = file_.read_tile(t);
 
-    std::cerr << "calling setup\n";
-    if (not se.call_setup(&params, clopts.script_args)) {
-        std::cerr << "Why didn't that work?\n";
-        return;
+        std::lock_guard<std::mutex> l(mtx_);
+        if (find(t) == tiles_.end()) {
+            tiles_.emplace_front(t, std::move(rows));
+            if (tiles_.size() > capacity_)
+                tiles_.pop_back();
+        }
+        return tiles_.front().second[r];
+    }
+
+  private:
+    // Moves tile t to the front if it is there.
+    auto find(int t) -> decltype(tiles_.begin()) {
+        auto iter = std::find_if(tiles_.begin(), tiles_.end(),
+                [t](auto const &entry) { return entry.first == t; });
+        if (iter != tiles_.end() and iter != tiles_.begin())
+            tiles_.splice(tiles_.begin(), tiles_, iter);
+        return iter;
     }
-    std::cerr << "setup call complete\n";
+};
 
+// Files from before version 2.2 do not have the stats. Gather them with
+// a pass over the rows on all cores.
+fractal_stats gather_stats(FractalFile const &data, row_getter const &get_row) {
+    if (data.has_stats())
+        return data.get_stats();
 
-	auto rows = data.get_rows();
+    auto params = data.get_meta_data();
+    fractal_stats retval(params.limit);
+    std::mutex mtx;
 
-    if (se.has_prepass()) {
-        std::cout << "calling prepass\n";
-        for (int i = 0; i < rows->size(); ++i) {
-            auto data_row = (*rows)[i];
-            
+    parallel_for(params.samples_img, 0, [&](int begin, int end) {
+        fractal_stats local(params.limit);
+        for (int i = begin; i < end; ++i) {
+            auto data_row = get_row(i);
             for (int j = 0; j < data_row->size(); ++j) {
+                int iterations = data_row->iterations(j);
+                if (data_row->diverged(j) and iterations >= 0 and iterations <= params.limit)
+                    local.add(iterations);
+            }
+        }
 
-                se.call_prepass((*data_row)[j]);
+        std::lock_guard<std::mutex> l(mtx);
+        retval.merge(local);
+    });
+
+    return retval;
+}
+
+// Color the rows a band at a time, with worker w taking every jobs'th row
+// of the band starting at w, and write them out in order.
+void color_bands(image_colorizer &ic, int row_count, row_getter const &get_row,
+        ImageFile &output_file) {
+
+    int jobs = ic.jobs();
+    int band_size = jobs * ROWS_PER_WORKER;
+    auto band = std::vector<std::vector<pixel>>(band_size);
+
+    for (int band_start = 0; band_start < row_count; band_start += band_size) {
+        int band_end = std::min(row_count, band_start + band_size);
+
+        parallel_for(jobs, jobs, [&](int begin, int end) {
+            for (int w = begin; w < end; ++w) {
+                for (int i = band_start + w; i < band_end; i += jobs) {
+                    ic.colorize_row(w, i, *get_row(i), band[i - band_start]);
+                }
             }
+            ic.thread_done();
+        });
+
+        for (int i = band_start; i < band_end; ++i) {
+            output_file.write_row(band[i - band_start]);
         }
     }
+}
 
-    std::cout << "calling precolor\n";
-    se.call_precolor();
+void color_image(colorator_options const &clopts, FractalFile const &data) {
+    auto params = data.get_meta_data();
+    check_image_size(clopts.output_file, params.samples_img, params.samples_real);
+    auto rows = data.get_rows();
+
+    // Without the rows in memory, each pass (stats, prepass, coloring)
+    // reads the tiles again. Enough of them are kept for every thread to
+    // be working on a different one.
+    std::unique_ptr<tile_cache> tiles;
+    row_getter get_row;
+    if (rows) {
+        get_row = [&](int i) { return (*rows)[i]; };
+    } else {
+        int threads = std::max(default_jobs(clopts.jobs), default_jobs());
+        tiles = std::make_unique<tile_cache>(data, 2 * threads + 2);
+        get_row = [&](int i) { return tiles->row(i); };
+        std::cout << "streaming " << data.tile_count() << " tiles\n";
+    }
 
-    auto pixels = std::vector<pixel>{};
-    std::cout << "colorizing\n";
-	for (int i = 0; i < rows->size(); ++i) {
-        auto data_row = (*rows)[i];
-		
-        pixels.clear();
+    auto stats = gather_stats(data, get_row);
 
-        for (int j = 0; j < data_row->size(); ++j) {
-            pixels.push_back(se.call_colorize((*data_row)[j]));
-        }
+    std::cerr << "params.limit = " << params.limit << "\n";
+
+    image_colorizer ic(clopts, params, stats);
+
+    auto output_file = make_image_file(clopts.output_file, params.samples_img,
+            params.samples_real);
 
-        output_file.write_row(pixels);
+    if (ic.has_prepass()) {
+        ic.prepass(params.samples_img, get_row);
     }
 
+    ic.start_coloring();
+
+    color_bands(ic, params.samples_img, get_row, *output_file);
+
+    ic.report();
 }
 
+void compute_and_color_image(colorator_options const &clopts,
+        fractal_params const &fp, fractal_meta_data const &meta) {
+
+    check_image_size(clopts.output_file, meta.samples_img, meta.samples_real);
+
+    // The iteration range is not known until everything is computed.
+    auto params = meta;
+    params.min_iterations = 0;
+    params.max_iterations = params.limit;
+    std::cerr << "fused: coloring with min_iterations = 0 and max_iterations = "
+        << params.limit << "\n";
+    auto stats = fractal_stats(params.limit);
+
+    image_colorizer ic(clopts, params, stats);
+
+    if (ic.has_prepass())
+        throw std::runtime_error("The coloring has a prepass, it cannot be fused with the compute");
+    if (ic.needs_stats())
+        throw std::runtime_error("The coloring needs the iteration statistics, "
+                "it cannot be fused with the compute");
+
+    ic.start_coloring();
+
+    auto output_file = make_image_file(clopts.output_file, params.samples_img,
+            params.samples_real);
+
+    row_computer computer(fp);
+
+    // The rows of a band are computed on all the threads. If the coloring
+    // allows it, each thread colors its rows as well, otherwise they are
+    // colored in order as they are written.
+    int jobs = default_jobs(clopts.jobs);
+    bool color_in_workers = (ic.jobs() == jobs);
+    std::cout << "computing and coloring on " << jobs << " threads\n";
+
+    int band_size = jobs * ROWS_PER_WORKER;
+    auto band_points = std::vector<std::shared_ptr<point_row>>(band_size);
+    auto band = std::vector<std::vector<pixel>>(band_size);
+    auto worker_stats = std::vector<fractal_stats>(jobs, fractal_stats(params.limit));
+
+    auto start_time = std::chrono::steady_clock::now();
+
+    for (int band_start = 0; band_start < params.samples_img; band_start += band_size) {
+        int band_end = std::min(params.samples_img, band_start + band_size);
+
+        parallel_for(jobs, jobs, [&](int begin, int end) {
+            for (int w = begin; w < end; ++w) {
+                for (int i = band_start + w; i < band_end; i += jobs) {
+                    auto data_row = computer.compute_row(i, worker_stats[w]);
+                    if (color_in_workers)
+                        ic.colorize_row(w, i, *data_row, band[i - band_start]);
+                    else
+                        band_points[i - band_start] = data_row;
+                }
+            }
+            if (color_in_workers)
+                ic.thread_done();
+        });
+
+        for (int i = band_start; i < band_end; ++i) {
+            if (not color_in_workers) {
+                ic.colorize_row(0, i, *band_points[i - band_start], band[i - band_start]);
+                band_points[i - band_start].reset();
+            }
+            output_file->write_row(band[i - band_start]);
+        }
+    }
+
+    std::chrono::duration<double> elapsed = 
+        std::chrono::steady_clock::now() - start_time;
+    std::cout << "compute and color time = " << std::setprecision(3) 
+        << elapsed.count() << " s\n";
+
+    ic.report();
+}
@@ -17,6 +17,12 @@ colorator_options parse_commandline(int argc, char**argv) {
             ("i,input-file", ".fract file to read for fractal data", cxxopts::value(clopts.input_file))
             ("s,script-file", "angelscript file to read for coloring algorithm", cxxopts::value(clopts.script_file))
             ("a,args", "key value pairs separated by semi-colon to pass to script", cxxopts::value(clopts.script_args))
+            ("colorizer", "Native coloring algorithm to use instead of a script "
+                "(builtin:smooth-hsv, builtin:histogram, builtin:multi-erf or plugin:<path>)", cxxopts::value(clopts.colorizer))
+            ("script-cache", "Directory in which to keep compiled scripts", cxxopts::value(clopts.script_cache))
+            ("j,jobs", "Number of threads to color with, for scripts marked [parallel] (0 = all cores)", cxxopts::value(clopts.jobs)->default_value("0"))
+            ("stream", "Read the .fract file a tile at a time while coloring, rather than all at once",
+                cxxopts::value(clopts.stream)->default_value("false"))
             ;
 
 
@@ -34,31 +40,40 @@ colorator_options parse_commandline(int argc, char**argv) {
         exit(1);
     }
 
+    if (clopts.jobs < 0) {
+        std::cerr << "--jobs must be nonnegative\n";
+        exit(1);
+    }
+
     if (clopts.input_file == "") throw std::runtime_error("No input file specified");
     if (clopts.output_file == "") {
         std::cerr << "No output file path specified\n";
         exit(1);
     }
-    if (clopts.script_file == "") throw std::runtime_error("No script file specified");
+    if (clopts.script_file == "" and clopts.colorizer == "") 
+        throw std::runtime_error("No script file or colorizer specified");
+    if (clopts.script_file != "" and clopts.colorizer != "") {
+        std::cerr << "Only one of --script-file and --colorizer may be given\n";
+        exit(1);
+    }
     
     return clopts;
 
 }
 
-auto read_fractal_data(std::string input_file_name) {
-
-    std::fstream input{input_file_name, std::ios::in | std::ios::binary};
-
-    return FractalFile::read_from_file(input_file_name);
+auto read_fractal_data(colorator_options const &clopts) {
 
+    if (clopts.stream)
+        return FractalFile::open_tiles(clopts.input_file);
 
+    return FractalFile::read_from_file(clopts.input_file);
 }
 
 int main (int argc, char*argv[]) {
 
     auto clopts = parse_commandline(argc, argv);
 
-    auto data = read_fractal_data(clopts.input_file);
+    auto data = read_fractal_data(clopts);
 
     color_image(clopts, *data);
 
@@ -0,0 +1,174 @@
+#include "image_colorizer.hpp"
+
+#include "builtin_colorizers.hpp"
+#include "plugin_colorizer.hpp"
+#include "parallel_for.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+point_reader::point_reader(fractal_meta_data const &params) :
+    escape_radius(params.escape_radius),
+    loglog_escape(std::log2(std::log2(params.escape_radius))),
+    has_fraction(params.has_channel(channel_id::fraction)),
+    has_modulus(params.has_channel(channel_id::last_modulus)),
+    has_value(params.has_channel(channel_id::last_value))
+{}
+
+// --colorizer builtin:<name> or plugin:<path>
+std::unique_ptr<native_colorizer> make_native_colorizer(std::string const &spec) {
+    auto has_prefix = [&](std::string const &prefix) {
+        return spec.compare(0, prefix.size(), prefix) == 0;
+    };
+
+    if (has_prefix("builtin:"))
+        return make_builtin_colorizer(spec.substr(8));
+    if (has_prefix("plugin:"))
+        return load_colorizer_plugin(spec.substr(7));
+
+    throw std::runtime_error("Unknown colorizer '" + spec +
+            "' - expected builtin:<name> or plugin:<path>");
+}
+
+image_colorizer::image_colorizer(colorator_options const &clopts,
+        fractal_meta_data const &params, fractal_stats const &stats) :
+    clopts_(clopts), params_(params), reader_(params) {
+
+    if (not clopts.colorizer.empty()) {
+        native_ = make_native_colorizer(clopts.colorizer);
+        native_->setup(params_, stats, parse_color_args(clopts.script_args));
+        return;
+    }
+
+    se_ = std::make_unique<ColorScriptEngine>();
+    se_->set_stats(&stats);
+
+    se_->set_cache_dir(clopts.script_cache);
+    se_->initialize(clopts.script_file);
+
+    std::cerr << "calling setup\n";
+    if (not se_->call_setup(&params_, clopts.script_args)) {
+        throw std::runtime_error("Call to setup() failed");
+    }
+    std::cerr << "setup call complete\n";
+}
+
+image_colorizer::~image_colorizer() = default;
+
+bool image_colorizer::has_prepass() {
+    if (native_)
+        return native_->has_prepass();
+    return se_->has_prepass();
+}
+
+bool image_colorizer::needs_stats() {
+    if (native_)
+        return native_->needs_stats();
+    return se_->uses_stats();
+}
+
+void image_colorizer::prepass(int row_count,
+        std::function<std::shared_ptr<point_row>(int)> const &get_row) {
+
+    if (native_) {
+        std::cout << "calling prepass\n";
+        auto points = std::vector<fractal_point_data>{};
+        for (int i = 0; i < row_count; ++i) {
+            reader_.get_row(*get_row(i), points);
+            native_->prepass_row(i, points);
+        }
+        return;
+    }
+
+    if (not se_->has_parallel_prepass()) {
+        std::cout << "calling prepass\n";
+        auto points = std::vector<fractal_point_data>{};
+        for (int i = 0; i < row_count; ++i) {
+            reader_.get_row(*get_row(i), points);
+            se_->call_prepass_row(points);
+        }
+        return;
+    }
+
+    // Each worker collects its rows into its own prepass_state. They
+    // are merged in row order before precolor.
+    int jobs = default_jobs(clopts_.jobs);
+    std::cout << "calling prepass on " << jobs << " threads\n";
+
+    auto prepassers = std::vector<std::unique_ptr<ColorScriptEngine::Prepasser>>{};
+    for (int w = 0; w < jobs; ++w) {
+        prepassers.push_back(se_->make_prepasser());
+    }
+
+    parallel_for(jobs, jobs, [&](int begin, int end) {
+        auto points = std::vector<fractal_point_data>{};
+        for (int w = begin; w < end; ++w) {
+            int row_begin = int(static_cast<long long>(row_count) * w / jobs);
+            int row_end   = int(static_cast<long long>(row_count) * (w+1) / jobs);
+            for (int i = row_begin; i < row_end; ++i) {
+                reader_.get_row(*get_row(i), points);
+                prepassers[w]->prepass_row(points);
+            }
+        }
+        if (jobs > 1)
+            asThreadCleanup();
+    });
+
+    std::cout << "calling precolor\n";
+    se_->call_precolor(prepassers);
+}
+
+void image_colorizer::start_coloring() {
+    if (native_) {
+        native_->precolor();
+        jobs_ = native_->is_parallel() ? default_jobs(clopts_.jobs) : 1;
+        std::cout << "colorizing with " << clopts_.colorizer << " on " << jobs_ << " threads\n";
+        points_.resize(jobs_);
+        return;
+    }
+
+    // call_precolor(prepassers) has already been called for a parallel
+    // prepass
+    if (not se_->has_parallel_prepass()) {
+        std::cout << "calling precolor\n";
+        se_->call_precolor();
+    }
+
+    // Scripts that share state between points have to be run on one
+    // thread, in order.
+    jobs_ = se_->colorize_is_parallel() ? default_jobs(clopts_.jobs) : 1;
+    std::cout << "colorizing on " << jobs_ << " threads\n";
+    if (se_->colorize_is_pure())
+        std::cout << "colorize is pure, reusing colors\n";
+
+    for (int w = 0; w < jobs_; ++w) {
+        colorizers_.push_back(se_->make_colorizer());
+    }
+    points_.resize(jobs_);
+}
+
+void image_colorizer::colorize_row(int worker, int row, point_row const &data_row,
+        std::vector<pixel> &pixels) {
+    reader_.get_row(data_row, points_[worker]);
+    if (native_)
+        native_->colorize_row(row, points_[worker], pixels);
+    else
+        colorizers_[worker]->colorize_row(row, points_[worker], pixels);
+}
+
+void image_colorizer::thread_done() {
+    // release the script engine's per thread memory
+    if (se_ and jobs_ > 1)
+        asThreadCleanup();
+}
+
+void image_colorizer::report() const {
+    if (native_)
+        return;
+
+    std::int64_t script_calls = 0;
+    for (auto const &c : colorizers_) {
+        script_calls += c->script_calls();
+    }
+    std::cout << "colorize script calls = " << script_calls << "\n";
+}
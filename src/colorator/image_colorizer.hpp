@@ -0,0 +1,112 @@
+#if !defined(MANDEL_IMAGE_COLORIZER_HPP_)
+#define MANDEL_IMAGE_COLORIZER_HPP_
+
+#include "colorator.hpp"
+#include "color_script_engine.hpp"
+#include "native_colorizer.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Reads points for the coloring, filling in what the file may not store.
+//
+// Compact files do not store last_modulus. It is rebuilt from the fraction
+// so that scripts written for the full encoding keep working. Files
+// without the fraction get it (and so smooth_iterations) from
+// last_modulus.
+struct point_reader {
+    double escape_radius;
+    double loglog_escape;
+    bool has_fraction;
+    bool has_modulus;
+    bool has_value;
+
+    explicit point_reader(fractal_meta_data const &params);
+
+    fractal_point_data get(point_row const &row, int j) const {
+        auto pd = row.get(j);
+        // Without a stored modulus, take it from the last value when that
+        // is there, else from the fraction.
+        if (has_value and not has_modulus)
+            pd.last_modulus = std::abs(pd.last_value);
+        if (pd.diverged) {
+            if (has_fraction and not has_modulus and not has_value)
+                pd.last_modulus = modulus_from_fraction(pd.fraction, escape_radius);
+            else if ((has_modulus or has_value) and not has_fraction)
+                pd.fraction = loglog_escape - std::log2(std::log2(pd.last_modulus));
+        }
+        pd.smooth_iterations = pd.iterations + pd.fraction;
+        return pd;
+    }
+
+    void get_row(point_row const &row, std::vector<fractal_point_data> &points) const {
+        points.clear();
+        for (int j = 0; j < row.size(); ++j) {
+            points.push_back(get(row, j));
+        }
+    }
+};
+
+// Colors rows with whatever clopts asks for - a script or a native
+// colorizer - through its whole lifecycle:
+//
+//    image_colorizer ic(clopts, params, stats);   // setup
+//    ic.prepass(...);                             // if has_prepass()
+//    ic.start_coloring();                         // precolor
+//    ic.colorize_row(w, ...) for 0 <= w < jobs()
+//
+// Rows given to colorize_row by the same worker w must not be colored at
+// the same time. Different workers may color at once.
+class image_colorizer {
+    colorator_options const &clopts_;
+    fractal_meta_data params_;
+    point_reader reader_;
+
+    std::unique_ptr<native_colorizer> native_;
+    std::unique_ptr<ColorScriptEngine> se_;
+
+    std::vector<std::unique_ptr<ColorScriptEngine::Colorizer>> colorizers_;
+    std::vector<std::vector<fractal_point_data>> points_;
+    int jobs_ = 1;
+
+  public:
+    // Loads the script or colorizer and calls its setup. stats must
+    // outlive the image_colorizer.
+    image_colorizer(colorator_options const &clopts,
+            fractal_meta_data const &params, fractal_stats const &stats);
+    ~image_colorizer();
+
+    image_colorizer(image_colorizer const &) = delete;
+    image_colorizer &operator=(image_colorizer const &) = delete;
+
+    fractal_meta_data const &params() const { return params_; }
+    point_reader const &reader() const { return reader_; }
+
+    bool has_prepass();
+
+    // true if the coloring is known to depend on the iteration statistics
+    bool needs_stats();
+
+    // Run the prepass over row_count rows. get_row(i) gives row i and
+    // may be called from several threads at once (with different i).
+    void prepass(int row_count,
+            std::function<std::shared_ptr<point_row>(int)> const &get_row);
+
+    // Calls precolor and gets ready to color on jobs() workers.
+    void start_coloring();
+
+    // Number of workers that may color at once.
+    int jobs() const { return jobs_; }
+
+    void colorize_row(int worker, int row, point_row const &data_row,
+            std::vector<pixel> &pixels);
+
+    // To be called on each thread that colored, when it is done.
+    void thread_done();
+
+    // Print what the coloring cost.
+    void report() const;
+};
+
+#endif
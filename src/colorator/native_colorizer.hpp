@@ -0,0 +1,44 @@
+#if !defined(MANDEL_NATIVE_COLORIZER_HPP_)
+#define MANDEL_NATIVE_COLORIZER_HPP_
+
+#include "color_args.hpp"
+#include "fractal_data.hpp"
+#include "pixel.hpp"
+
+#include <vector>
+
+// A coloring algorithm in native code (builtin or from a plugin) rather
+// than a script. The calls follow the script's lifecycle:
+//
+//   setup, prepass_row for each row in order (if has_prepass), precolor,
+//   then colorize_row for each row.
+class native_colorizer {
+  public:
+    virtual ~native_colorizer() = default;
+
+    virtual void setup(fractal_meta_data const &params,
+            fractal_stats const &stats, color_args const &args) = 0;
+
+    // true if the coloring depends on the iteration statistics (beyond
+    // the min and max in params), so that it cannot be fused with the
+    // compute.
+    virtual bool needs_stats() const { return false; }
+
+    virtual bool has_prepass() const { return false; }
+    virtual void prepass_row(int /*row*/,
+            std::vector<fractal_point_data> const &/*points*/) {}
+
+    virtual void precolor() {}
+
+    // true if colorize_row may be called for different rows on several
+    // threads at once. Otherwise the rows are colored in order on one
+    // thread.
+    virtual bool is_parallel() const { return true; }
+
+    // Color a row. pixels is resized to match points.
+    virtual void colorize_row(int row,
+            std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels) const = 0;
+};
+
+#endif
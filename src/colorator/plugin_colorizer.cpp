@@ -0,0 +1,158 @@
+#include "plugin_colorizer.hpp"
+
+#include "colorizer_plugin.h"
+
+#include <dlfcn.h>
+
+#include <iostream>
+#include <stdexcept>
+
+static_assert(MAX_TRAPS == 4, "mandel_point.traps must hold MAX_TRAPS values");
+
+namespace {
+
+class plugin_colorizer : public native_colorizer {
+    std::string path_;
+    void *library_ = nullptr;
+    mandel_colorizer const *plugin_ = nullptr;
+    void *state_ = nullptr;
+
+    static void to_plugin(std::vector<fractal_point_data> const &points,
+            std::vector<mandel_point> &out) {
+        out.resize(points.size());
+        for (std::size_t j = 0; j < points.size(); ++j) {
+            auto const &p = points[j];
+            auto &q = out[j];
+            q.last_value_real = p.last_value.real();
+            q.last_value_img = p.last_value.imag();
+            q.last_modulus = p.last_modulus;
+            q.distance = p.distance;
+            for (int t = 0; t < MAX_TRAPS; ++t) {
+                q.traps[t] = p.traps[t];
+            }
+            q.fraction = p.fraction;
+            q.smooth_iterations = p.smooth_iterations;
+            q.iterations = p.iterations;
+            q.diverged = p.diverged;
+            q.period = p.period;
+            q.reserved = 0;
+        }
+    }
+
+    void check(int32_t status, char const *what) const {
+        if (status != 0) {
+            throw std::runtime_error("colorizer plugin " + path_ + ": " + what +
+                    " failed (" + std::to_string(status) + ")");
+        }
+    }
+
+  public:
+    explicit plugin_colorizer(std::string const &path) : path_(path) {
+        library_ = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (not library_) {
+            throw std::runtime_error("Could not load colorizer plugin: " + std::string(dlerror()));
+        }
+
+        auto entry = reinterpret_cast<mandel_colorizer_entry_func>(
+                dlsym(library_, MANDEL_COLORIZER_ENTRY));
+        if (entry) 
+            plugin_ = entry();
+
+        if (not plugin_) {
+            dlclose(library_);
+            throw std::runtime_error("Colorizer plugin " + path + " has no " MANDEL_COLORIZER_ENTRY "()");
+        }
+        if (plugin_->abi_version != MANDEL_COLORIZER_ABI_VERSION) {
+            dlclose(library_);
+            throw std::runtime_error("Colorizer plugin " + path + " is for interface version " +
+                    std::to_string(plugin_->abi_version) + ", expected " +
+                    std::to_string(MANDEL_COLORIZER_ABI_VERSION));
+        }
+        if (not plugin_->create or not plugin_->destroy or not plugin_->colorize) {
+            dlclose(library_);
+            throw std::runtime_error("Colorizer plugin " + path + " is missing create, destroy or colorize");
+        }
+    }
+
+    ~plugin_colorizer() {
+        if (state_)
+            plugin_->destroy(state_);
+        dlclose(library_);
+    }
+
+    void setup(fractal_meta_data const &params, fractal_stats const &stats,
+            color_args const &args) override {
+        mandel_meta_data meta{};
+        meta.bb_top_left_real = params.bb_top_left.real();
+        meta.bb_top_left_img = params.bb_top_left.imag();
+        meta.bb_bottom_right_real = params.bb_bottom_right.real();
+        meta.bb_bottom_right_img = params.bb_bottom_right.imag();
+        meta.escape_radius = params.escape_radius;
+        meta.limit = params.limit;
+        meta.samples_real = params.samples_real;
+        meta.samples_img = params.samples_img;
+        meta.max_iterations = params.max_iterations;
+        meta.min_iterations = params.min_iterations;
+        meta.has_distance = params.has_channel(channel_id::distance);
+        meta.trap_count = params.trap_count;
+        meta.diverged_count = stats.diverged_count;
+        meta.histogram = stats.histogram.data();
+        meta.histogram_size = int32_t(stats.histogram.size());
+
+        auto plugin_args = std::vector<mandel_arg>{};
+        for (auto const &[key, value] : args) {
+            plugin_args.push_back({key.c_str(), value.c_str()});
+        }
+
+        state_ = plugin_->create(&meta, plugin_args.data(), int32_t(plugin_args.size()));
+        if (not state_) {
+            throw std::runtime_error("colorizer plugin " + path_ + ": create failed");
+        }
+    }
+
+    bool has_prepass() const override { return plugin_->prepass != nullptr; }
+
+    void prepass_row(int row, std::vector<fractal_point_data> const &points) override {
+        thread_local std::vector<mandel_point> plugin_points;
+        to_plugin(points, plugin_points);
+        check(plugin_->prepass(state_, row, plugin_points.data(), int32_t(plugin_points.size())),
+                "prepass");
+    }
+
+    void precolor() override {
+        if (plugin_->precolor)
+            check(plugin_->precolor(state_), "precolor");
+    }
+
+    bool needs_stats() const override {
+        return (plugin_->flags & MANDEL_COLORIZER_NEEDS_STATS) != 0;
+    }
+
+    bool is_parallel() const override {
+        return (plugin_->flags & MANDEL_COLORIZER_PARALLEL) != 0;
+    }
+
+    void colorize_row(int row, std::vector<fractal_point_data> const &points,
+            std::vector<pixel> &pixels) const override {
+        thread_local std::vector<mandel_point> plugin_points;
+        thread_local std::vector<mandel_pixel> plugin_pixels;
+        to_plugin(points, plugin_points);
+        plugin_pixels.assign(points.size(), mandel_pixel{});
+
+        check(plugin_->colorize(state_, row, plugin_points.data(), int32_t(plugin_points.size()),
+                    plugin_pixels.data()), "colorize");
+
+        pixels.resize(points.size());
+        for (std::size_t j = 0; j < points.size(); ++j) {
+            auto const &c = plugin_pixels[j];
+            // note the order pixel takes them in
+            pixels[j] = pixel(int(c.red), int(c.blue), int(c.green));
+        }
+    }
+};
+
+} // namespace
+
+std::unique_ptr<native_colorizer> load_colorizer_plugin(std::string const &path) {
+    return std::make_unique<plugin_colorizer>(path);
+}
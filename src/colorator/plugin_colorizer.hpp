@@ -0,0 +1,14 @@
+#if !defined(MANDEL_PLUGIN_COLORIZER_HPP_)
+#define MANDEL_PLUGIN_COLORIZER_HPP_
+
+#include "native_colorizer.hpp"
+
+#include <memory>
+#include <string>
+
+// Load a colorizer plugin (see colorizer_plugin.h) from the shared library
+// at path. Throws std::runtime_error if it cannot be loaded or was built
+// for another version of the interface.
+std::unique_ptr<native_colorizer> load_colorizer_plugin(std::string const &path);
+
+#endif
@@ -2,74 +2,209 @@
 
 
 #include "fractal_file.hpp"
-#include "work_queue.hpp"
+#include "ordered_pipeline.hpp"
+#include "parallel_for.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <functional>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <vector>
 
+// Rows each worker may be ahead of the file writer
+const int PIPELINE_ROWS_PER_JOB = 8;
 
-void write_fractal_file(fractalator_options const &clopts, 
-        std::shared_ptr<point_grid> data) {
-    std::cout << "Writing File\n";
 
-    int max_iter = 0;
-    int min_iter = clopts.limit;
+orbit_options make_orbit_options(fractalator_options const &clopts) {
+    if (clopts.traps.size() > MAX_TRAPS) {
+        throw std::runtime_error("Too many orbit traps");
+    }
+
+    orbit_options retval;
+    retval.channels = clopts.channels | CORE_CHANNELS;
+    if (clopts.distance)
+        retval.channels |= channel_bit(channel_id::distance);
 
-    for (auto const & data_row : *data) {
-        for (auto const & res : *data_row) {
-            if (res.diverged) {
-                if (res.iterations > max_iter) max_iter = res.iterations;
-                if (res.iterations < min_iter) min_iter = res.iterations;
-            }
-        }
+    retval.trap_count = clopts.traps.size();
+    for (int i = 0; i < retval.trap_count; ++i) {
+        retval.traps[i] = clopts.traps[i];
     }
-    auto output_file = FractalFile{clopts.output_file};
-    output_file.add_metadata(
-            { { clopts.left_top_real, clopts.left_top_img },
+    if (retval.trap_count > 0) 
+        retval.channels |= channel_bit(channel_id::trap);
+    else
+        retval.channels &= ~channel_bit(channel_id::trap);
+
+    retval.encoding = clopts.compact ? point_encoding::compact : point_encoding::full;
+    retval.channels = encoding_channels(retval.channels, retval.encoding);
+
+    return retval;
+}
+
+fractal_meta_data make_meta_data(fractalator_options const &clopts,
+        int max_iter, int min_iter) {
+
+    fractal_meta_data retval{ 
+                { clopts.left_top_real, clopts.left_top_img },
                 { clopts.right_bottom_real, clopts.right_bottom_img },
                 clopts.escape,
                 clopts.limit,
                 clopts.width,
                 clopts.height,
                 max_iter,
-                min_iter }
-            );
+                min_iter };
 
-    for (auto const & data_row : *data) {
-        output_file.write_row(*data_row);
+    auto orbit = make_orbit_options(clopts);
+    retval.channels = orbit.channels;
+    retval.encoding = orbit.encoding;
+    retval.trap_count = orbit.trap_count;
+    for (int i = 0; i < orbit.trap_count; ++i) {
+        retval.traps[i] = orbit.traps[i];
     }
 
-    output_file.finalize();
+    return retval;
 }
 
-void compute_fractal(fractalator_options const &clopts) {
+fractal_params make_fractal_params(fractalator_options const &clopts) {
+    return fractal_params{
+                std::complex<double>{ clopts.left_top_real, clopts.left_top_img },
+                std::complex<double>{ clopts.right_bottom_real, clopts.right_bottom_img },
+                clopts.escape,
+                clopts.limit,
+                clopts.width,
+                clopts.height,
+                make_orbit_options(clopts)
+            };
+}
+
+// Benchmark output. The cost is reported per iteration of the fractal
+// formula so that runs with different kernels (i.e. different channels)
+// can be compared directly. seconds is the compute time summed over the
+// threads, so writing the file is not counted.
+void report_timing(fractalator_options const &clopts,
+        long long total_iterations, double seconds) {
+
+    std::cout << "compute time = " << std::setprecision(3) << seconds << " s"
+        << " channels = " << channel_names(make_orbit_options(clopts).channels)
+        << " traps = " << clopts.traps.size()
+        << " iterations = " << total_iterations;
+    if (total_iterations > 0) {
+        std::cout << " ns/iteration/thread = " 
+            << (seconds * 1.0e9) / total_iterations;
+    }
+    std::cout << "\n";
+}
+
+// Compute the rows on the worker threads and hand them to consume in
+// order on the calling thread. stats is filled in.
+void compute_rows(fractalator_options const &clopts, fractal_stats &stats,
+        std::function<void(int, std::shared_ptr<point_row>)> const &consume) {
+
     std::cout << "Computing fractal\n";
     std::cout << "bounding box = " 
         << std::fixed << std::setprecision( 16 ) 
         << "(" << clopts.left_top_real << ", " << clopts.left_top_img << "), "
         << "(" << clopts.right_bottom_real << ", " << clopts.right_bottom_img << ")\n";
 
-    std::shared_ptr<point_grid> fractal_data;
+    row_computer computer(make_fractal_params(clopts));
+    auto const &fp = computer.params();
 
-    auto fp = fractal_params{
-                std::complex<double>{ clopts.left_top_real, clopts.left_top_img },
-                std::complex<double>{ clopts.right_bottom_real, clopts.right_bottom_img },
-                clopts.escape,
-                clopts.limit,
-                clopts.width,
-                clopts.height
-            };
+    int workers = default_jobs(clopts.jobs);
+    std::cerr << "Parallel with " << workers << " jobs\n";
+
+    auto worker_stats = std::vector<fractal_stats>(workers, fractal_stats(fp.limit));
+    auto worker_iterations = std::vector<long long>(workers, 0);
+    auto worker_seconds = std::vector<double>(workers, 0.0);
+
+    ordered_pipeline(fp.samples_img, workers, PIPELINE_ROWS_PER_JOB * workers,
+        [&](int w, int row) {
+            auto start_time = std::chrono::steady_clock::now();
+            auto data_row = computer.compute_row(row, worker_stats[w]);
+            std::chrono::duration<double> elapsed = 
+                std::chrono::steady_clock::now() - start_time;
+            worker_seconds[w] += elapsed.count();
+
+            for (int j = 0; j < data_row->size(); ++j) {
+                worker_iterations[w] += data_row->iterations(j);
+            }
+            return data_row;
+        },
+        consume);
+
+    stats = fractal_stats(fp.limit);
+    long long total_iterations = 0;
+    double seconds = 0.0;
+    for (int w = 0; w < workers; ++w) {
+        stats.merge(worker_stats[w]);
+        total_iterations += worker_iterations[w];
+        seconds += worker_seconds[w];
+    }
+
+    report_timing(clopts, total_iterations, seconds);
+}
+
+void compute_fractal(fractalator_options const &clopts) {
+    fractal_stats stats;
+
+    compute_and_write_fractal(clopts, stats);
+}
+
+std::shared_ptr<point_grid> compute_fractal(fractalator_options const &clopts,
+        fractal_stats &stats) {
+
+    auto rows = std::make_shared<point_grid>(clopts.height);
 
-    if (clopts.jobs == 0) {
-        std::cerr << "Serial computation\n";
-        fractal_data = compute_fractal(fp);
-    } else {
-        std::cerr << "Parallel with " << clopts.jobs << " jobs\n";
-        fractal_work_queue wq(clopts.jobs*2);
-        fractal_data = compute_fractal(fp, wq, clopts.jobs);
-    } 
+    compute_rows(clopts, stats,
+        [&](int row, std::shared_ptr<point_row> data_row) {
+            (*rows)[row] = std::move(data_row);
+        });
 
+    return rows;
+}
+
+void compute_and_write_fractal(fractalator_options const &clopts,
+        fractal_stats &stats) {
+
+    // The iteration range is filled in by finalize() from the stats.
+    auto part_file_name = clopts.output_file + ".part";
+    auto output_file = FractalFile{part_file_name};
+    if (clopts.compress)
+        output_file.set_tile_codec(tile_codec::packed);
+    output_file.add_metadata(make_meta_data(clopts));
+
+    // The rows are written as they are done, in order, while the workers
+    // go on with the next ones.
+    compute_rows(clopts, stats,
+        [&](int row, std::shared_ptr<point_row> data_row) {
+            if (row % 100 == 0)
+                std::cerr << "Writing row : " << row << "\n";
+            output_file.write_row(*data_row);
+        });
+
+    output_file.set_stats(stats);
+    output_file.finalize();
+
+    std::filesystem::rename(part_file_name, clopts.output_file);
+}
+
+void write_fractal_file(fractalator_options const &clopts,
+        std::shared_ptr<point_grid> data, fractal_stats const &stats) {
+    std::cout << "Writing File\n";
+
+    auto part_file_name = clopts.output_file + ".part";
+    auto output_file = FractalFile{part_file_name};
+    if (clopts.compress)
+        output_file.set_tile_codec(tile_codec::packed);
+    output_file.add_metadata(make_meta_data(clopts));
+
+    for (auto const &row : *data) {
+        output_file.write_row(*row);
+    }
+
+    output_file.set_stats(stats);
+    output_file.finalize();
 
-    write_fractal_file(clopts, fractal_data);
+    std::filesystem::rename(part_file_name, clopts.output_file);
 }
@@ -12,6 +12,8 @@ fractalator_options parse_commandline(int argc, char**argv) {
     fractalator_options clopts;
 
     bool help_option;
+    std::vector<std::string> trap_specs;
+    std::string channel_list;
 
     cxxopts::Options options("fractalator", "Mandelbrot Generator");
 
@@ -32,7 +34,16 @@ fractalator_options parse_commandline(int argc, char**argv) {
         ("cr", "Center Real", cxxopts::value(clopts.center_real))
         ("ci", "Center Imaginary", cxxopts::value(clopts.center_img))
         ("l,limit", "Number of iterations to check divergence", cxxopts::value(clopts.limit)->default_value("1000"))
-        ("j,jobs", "Number of parallel threads to use", cxxopts::value(clopts.jobs)->default_value("0"))
+        ("j,jobs", "Number of threads to compute with (0 = all cores)", cxxopts::value(clopts.jobs)->default_value("0"))
+        ("distance", "Compute the exterior distance estimate for each point", cxxopts::value(clopts.distance))
+        ("trap", "Orbit trap to evaluate, may be repeated (point:r,i line:r,i,deg cross:r,i[,deg])", 
+            cxxopts::value(trap_specs))
+        ("channels", "Comma separated data to compute for each point, in addition to the iterations. "
+            "Any of last_value,last_modulus,distance,period,traps,fraction or none",
+            cxxopts::value(channel_list)->default_value("last_value,last_modulus"))
+        ("compact", "Store the points in the compact encoding (16 bit iterations, floats, no last_value)",
+            cxxopts::value(clopts.compact))
+        ("compress", "Compress the .fract file (lossless)", cxxopts::value(clopts.compress))
         ;
 
 
@@ -60,6 +71,27 @@ fractalator_options parse_commandline(int argc, char**argv) {
         exit(1);
     }
 
+    if (trap_specs.size() > MAX_TRAPS) {
+        std::cerr << "At most " << MAX_TRAPS << " --trap options may be given\n";
+        exit(1);
+    }
+
+    try {
+        clopts.channels = parse_channels(channel_list) | CORE_CHANNELS;
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << "\n";
+        exit(1);
+    }
+
+    for (auto const &spec : trap_specs) {
+        try {
+            clopts.traps.push_back(parse_orbit_trap(spec));
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            exit(1);
+        }
+    }
+
     if (clopts.samples > 0) {
         if (clopts.samples < 10) {
             std::cerr << "Samples must be 10 or greater\n";
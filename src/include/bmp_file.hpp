@@ -1,13 +1,14 @@
 #if !defined(BMP_FILE_HPP_)
 #define BMP_FILE_HPP_
 
-#include "pixel.hpp"
+#include "image_file.hpp"
 
+#include <cstdint>
 #include <fstream>
 #include <vector>
 
 
-class BMPFile {
+class BMPFile : public ImageFile {
     std::string file_name_;
     int height_;
     int width_;
@@ -23,7 +24,7 @@ class BMPFile {
         width_ = width;
     }
 
-    ~BMPFile() {
+    ~BMPFile() override {
         if (out_stream_) {
             out_stream_->close();
             delete out_stream_;
@@ -31,8 +32,14 @@ class BMPFile {
         }
     }
 
+    // Size of the file for an image of height x width. The BMP header
+    // holds it in 32 bits.
+    static std::uint64_t file_size(int height, int width);
+    // Throws if the image is too large for a BMP file.
+    static void check_size(int height, int width);
+
     void initialize_file();
-    void write_row(std::vector<pixel> const & data);
+    void write_row(std::vector<pixel> const & data) override;
 
   private:
 
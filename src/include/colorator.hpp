@@ -1,6 +1,7 @@
 #if not defined(MANDEL_COLORATOR_HPP_)
 #define MANDEL_COLORATOR_HPP_
 
+#include "compute.hpp"
 #include "fractal_file.hpp"
 
 struct colorator_options {
@@ -8,8 +9,28 @@ struct colorator_options {
     std::string output_file;
     std::string script_file = "";
     std::string script_args = "";
+    // threads for scripts that allow parallel coloring. 0 = all cores.
+    int jobs = 0;
+    // directory to keep compiled scripts in. Empty = always compile.
+    std::string script_cache = "";
+    // native coloring algorithm to use instead of the script, e.g.
+    // "builtin:smooth-hsv". script_args are passed to it.
+    std::string colorizer = "";
+    // read the input a tile at a time rather than all at once
+    bool stream = false;
 };
 
+// If data was opened with FractalFile::open_tiles(), the rows are read a
+// tile at a time as they are colored (and again for each pass that needs
+// them), so only a few tiles are in memory at once.
 void color_image(colorator_options const &clopts, FractalFile const &data);
 
+// Compute the fractal and color it in the same pass, a band of rows at a
+// time, without keeping the points or writing a .fract file. The coloring
+// is set up before anything is computed, so it is told the iterations go
+// from 0 to the limit and is given no statistics. Throws if the coloring
+// has a prepass or needs the statistics.
+void compute_and_color_image(colorator_options const &clopts, 
+        fractal_params const &fp, fractal_meta_data const &params);
+
 #endif
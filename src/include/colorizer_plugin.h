@@ -0,0 +1,118 @@
+/*
+ * C interface for colorizer plugins.
+ *
+ * A plugin is a shared library that exports
+ *
+ *     const mandel_colorizer *mandel_colorizer_entry(void);
+ *
+ * and is used with `colorator --colorizer plugin:<path>`. The colorator
+ * calls it in the same order as a coloring script:
+ *
+ *     create       - once, with the meta data, statistics and --args
+ *     prepass      - for each row, in order, if given
+ *     precolor     - once, if given
+ *     colorize     - for each row
+ *     destroy      - once
+ *
+ * All the functions but create return 0 on success. Anything else stops
+ * the colorator with an error.
+ *
+ * This header only changes in ways that keep old plugins working. Any
+ * change to the structs bumps MANDEL_COLORIZER_ABI_VERSION, and the
+ * colorator refuses plugins built for a version it does not know.
+ */
+#if !defined(MANDEL_COLORIZER_PLUGIN_H_)
+#define MANDEL_COLORIZER_PLUGIN_H_
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MANDEL_COLORIZER_ABI_VERSION 1
+
+/* colorize may be called for different rows on several threads at once */
+#define MANDEL_COLORIZER_PARALLEL 0x1
+/* the coloring uses the histogram (or diverged_count) of the meta data,
+ * so it cannot be used with mandel --fused, which has no statistics */
+#define MANDEL_COLORIZER_NEEDS_STATS 0x2
+
+typedef struct mandel_meta_data {
+    double bb_top_left_real;
+    double bb_top_left_img;
+    double bb_bottom_right_real;
+    double bb_bottom_right_img;
+    double escape_radius;
+    int32_t limit;
+    int32_t samples_real;       /* points in a row */
+    int32_t samples_img;        /* number of rows */
+    int32_t max_iterations;     /* highest count of a diverged point */
+    int32_t min_iterations;     /* lowest count of a diverged point */
+    int32_t has_distance;
+    int32_t trap_count;
+
+    /* histogram[n] = number of diverged points with n iterations,
+     * for 0 <= n < histogram_size (limit + 1) */
+    int64_t diverged_count;
+    const int64_t *histogram;
+    int32_t histogram_size;
+} mandel_meta_data;
+
+/* See point_data in docs/scripting.md. Channels that were not computed
+ * are 0. */
+typedef struct mandel_point {
+    double last_value_real;
+    double last_value_img;
+    double last_modulus;
+    double distance;
+    double traps[4];
+    double fraction;
+    double smooth_iterations;
+    int32_t iterations;
+    int32_t diverged;
+    int32_t period;
+    int32_t reserved;
+} mandel_point;
+
+typedef struct mandel_pixel {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+} mandel_pixel;
+
+typedef struct mandel_arg {
+    const char *key;
+    const char *value;
+} mandel_arg;
+
+typedef struct mandel_colorizer {
+    int32_t abi_version;    /* MANDEL_COLORIZER_ABI_VERSION */
+    int32_t flags;          /* MANDEL_COLORIZER_* */
+
+    /* Returns the plugin's state, passed to the other functions, or NULL
+     * on error. The pointers are only valid during the call. */
+    void *(*create)(const mandel_meta_data *meta,
+            const mandel_arg *args, int32_t arg_count);
+    void (*destroy)(void *state);
+
+    /* Optional (NULL). count points of row. */
+    int32_t (*prepass)(void *state, int32_t row,
+            const mandel_point *points, int32_t count);
+    /* Optional (NULL). */
+    int32_t (*precolor)(void *state);
+
+    /* Write count pixels for the count points of row. */
+    int32_t (*colorize)(void *state, int32_t row,
+            const mandel_point *points, int32_t count, mandel_pixel *pixels);
+} mandel_colorizer;
+
+#define MANDEL_COLORIZER_ENTRY "mandel_colorizer_entry"
+
+typedef const mandel_colorizer *(*mandel_colorizer_entry_func)(void);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -2,11 +2,22 @@
 #define MANDEL_COMPUTE_HPP_
 
 #include "fixed_array.hpp"
-#include "work_queue.hpp"
 #include "fractal_data.hpp"
 
 #include <memory>
 #include <complex>
+#include <string>
+
+// What to compute along with the orbit.
+struct orbit_options {
+    channel_set channels = DEFAULT_CHANNELS;
+    point_encoding encoding = point_encoding::full;
+    int trap_count = 0;
+    orbit_trap traps[MAX_TRAPS];
+    // Orbit points closer than this are taken as a cycle for the period
+    // channel. row_computer derives it from the sample spacing.
+    double period_tolerance = 1.0e-12;
+};
 
 struct fractal_params {
     std::complex<double> bb_top_left;
@@ -15,6 +26,7 @@ struct fractal_params {
     int limit;
     int samples_real;
     int samples_img;
+    orbit_options orbit;
 };
 
 struct work_item {
@@ -27,17 +39,47 @@ struct work_item {
     double base_real;
     double real_increment;
     double escape_radius;
+    orbit_options orbit;
 };
 
-using fractal_work_queue = work_queue<work_item>;
+// Only the Channels are filled in. In particular
+//    distance - also tracks the derivative dz/dc along the orbit
+//    trap     - evaluates the orbit traps given in opts at each iteration
+//    period   - checks for cycles and stops early if one is found
+//    fraction - the smoothing term, computed at escape
+template<channel_set Channels>
+fractal_point_data mandelbrot_test(std::complex<double> test_point, 
+        int limit, double escape_radius, orbit_options const &opts);
+
+// Parse a trap description of the form
+//    point:<real>,<imag>
+//    line:<real>,<imag>,<angle in degrees>
+//    cross:<real>,<imag>[,<angle in degrees>]
+// throws std::runtime_error if it cannot be parsed.
+orbit_trap parse_orbit_trap(std::string const &spec);
 
-fractal_point_data mandelbrot_test(std::complex<double> test_point, int limit);
+// The diverged points are added to stats.
+void compute_slice(work_item wi, fractal_stats &stats);
 
-void compute_slice(work_item wi);
+// Computes single rows of the fractal, for callers that do not keep the
+// whole grid. Safe to use from several threads at once.
+class row_computer {
+    fractal_params p_;
+    channel_schema schema_;
+    double real_increment_;
+    double img_increment_;
 
-std::shared_ptr<point_grid> compute_fractal(fractal_params p);
-std::shared_ptr<point_grid> compute_fractal(fractal_params p,
-        fractal_work_queue &wq, int jobs);
+  public:
+    explicit row_computer(fractal_params p);
 
+    fractal_params const &params() const { return p_; }
+    channel_schema const &schema() const { return schema_; }
+
+    // The work to compute row into output.
+    work_item make_work_item(int row, std::shared_ptr<point_row> output) const;
+
+    // The diverged points are added to stats.
+    std::shared_ptr<point_row> compute_row(int row, fractal_stats &stats) const;
+};
 
 #endif
@@ -2,6 +2,7 @@
 #define MANDEL_FIXED_ARRAY_HPP_
 
 #include <memory>
+#include <stdexcept>
 
 template<class T>
 class fixed_array {
@@ -3,7 +3,136 @@
 
 #include "fixed_array.hpp"
 #include <complex>
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
+
+// Maximum number of orbit traps that can be evaluated in one computation.
+const int MAX_TRAPS = 4;
+
+// An orbit trap records the closest approach of the orbit to a shape.
+//
+// point - distance to center
+// line  - distance to the line through center at the given angle
+// cross - distance to the closer of the two perpendicular lines through
+//         center, the first of which is at the given angle.
+enum class trap_kind : int { point = 0, line = 1, cross = 2 };
+
+struct orbit_trap {
+    trap_kind kind = trap_kind::point;
+    std::complex<double> center = 0.0;
+    double angle = 0.0; // radians
+
+    bool operator==(orbit_trap const & o) const {
+        return kind == o.kind and center == o.center and angle == o.angle;
+    }
+};
+
+// ---------------------------------------------------------------------
+// Channels
+//
+// Each piece of data that can be computed for a point is a channel. Only
+// the channels that were asked for are computed, kept in memory and
+// written to the .fract file.
+// ---------------------------------------------------------------------
+enum class channel_id : std::uint8_t {
+    iterations   = 0,
+    diverged     = 1,
+    last_value   = 2,
+    last_modulus = 3,
+    distance     = 4,
+    period       = 5,
+    trap         = 6,
+    // the smoothing term log2(log2(escape)) - log2(log2(last_modulus))
+    // which is on (-1, 0] for diverged points.
+    fraction     = 7,
+};
+
+const int CHANNEL_ID_COUNT = 8;
+
+// How a channel's values are stored.
+enum class channel_type : std::uint8_t {
+    u8   = 0,
+    i32  = 1,
+    f64  = 2,
+    c128 = 3, // std::complex<double>
+    u16  = 4,
+    u32  = 5,
+    f32  = 6,
+    bit  = 7, // packed 8 to a byte, least significant bit first
+};
+
+// How the channels are encoded.
+//
+// full    - the original wide types
+// compact - iterations are 16 or 32 bits (depending on the limit), the
+//           divergence flag is a single bit, reals are floats and
+//           last_value/last_modulus are replaced by the fraction channel.
+enum class point_encoding : int { full = 0, compact = 1 };
+
+// A set of channels as a bit mask of (1 << channel_id).
+using channel_set = std::uint32_t;
+
+constexpr channel_set channel_bit(channel_id id) {
+    return channel_set{1} << static_cast<unsigned>(id);
+}
+
+// Always present
+const channel_set CORE_CHANNELS = channel_bit(channel_id::iterations) |
+                                  channel_bit(channel_id::diverged);
+
+// What is computed if nothing else is asked for - the original point data.
+const channel_set DEFAULT_CHANNELS = CORE_CHANNELS | 
+                                  channel_bit(channel_id::last_value) |
+                                  channel_bit(channel_id::last_modulus);
+
+struct channel_desc {
+    channel_id id;
+    channel_type type;
+    // Number of values per point. Only the trap channel has more than one.
+    std::uint8_t count = 1;
+
+    bool operator==(channel_desc const & o) const {
+        return id == o.id and type == o.type and count == o.count;
+    }
+};
+
+// The ordered list of channels in a row or a file record.
+using channel_schema = std::vector<channel_desc>;
+
+// Layout used for the given channel set. The order matches the original
+// record layout so that older files can be described by a schema.
+// limit is used to pick the iteration type for the compact encoding.
+channel_schema make_schema(channel_set channels, int trap_count,
+        point_encoding encoding = point_encoding::full, int limit = 0);
+
+channel_set schema_channels(channel_schema const &schema);
+
+point_encoding schema_encoding(channel_schema const &schema);
+
+// Bytes per value. 0 for bit.
+int channel_type_size(channel_type type);
+
+// Bytes per point for the schema. Only valid if the schema has no bit
+// channels (i.e. is not compact).
+int schema_record_size(channel_schema const &schema);
+
+// Bytes needed for a column of size points.
+std::size_t column_size(channel_desc const &ch, int size);
+
+// What the channels for an encoding actually are. compact always has the
+// fraction channel and never last_value/last_modulus.
+channel_set encoding_channels(channel_set channels, point_encoding encoding);
+
+// Undo the fraction channel. Used to give coloring scripts a last_modulus
+// for compact data.
+double modulus_from_fraction(double fraction, double escape_radius);
+
+// Comma separated list of channel names <-> channel_set.
+// parse_channels throws std::runtime_error for unknown names.
+channel_set parse_channels(std::string const &names);
+std::string channel_names(channel_set channels);
 
 struct fractal_meta_data {
     std::complex<double> bb_top_left;
@@ -14,31 +143,158 @@ struct fractal_meta_data {
     int samples_img;
     int max_iterations;
     int min_iterations;
+    // which data was computed for the points
+    channel_set channels = DEFAULT_CHANNELS;
+    point_encoding encoding = point_encoding::full;
+    int trap_count = 0;
+    orbit_trap traps[MAX_TRAPS];
 
     bool similar(fractal_meta_data const & o) const {
+        if (trap_count != o.trap_count)
+            return false;
+        for (int i = 0; i < trap_count; ++i) {
+            if (not (traps[i] == o.traps[i]))
+                return false;
+        }
+
         return (
                 (bb_top_left == o.bb_top_left) &&
                 (bb_bottom_right == o.bb_bottom_right) &&
                 (escape_radius == o.escape_radius) &&
                 (limit == o.limit) &&
                 (samples_real == o.samples_real) &&
-                (samples_img == o.samples_img)
+                (samples_img == o.samples_img) &&
+                (channels == o.channels) &&
+                (encoding == o.encoding)
                );
     }
+
+    bool has_channel(channel_id id) const {
+        return (channels & channel_bit(id)) != 0;
+    }
+};
+
+
+// Summary of the iteration counts of the diverged points. Gathered while
+// computing and kept in the .fract file.
+struct fractal_stats {
+    int min_iterations = 0;
+    int max_iterations = 0;
+    std::int64_t diverged_count = 0;
+    // number of diverged points for each iteration count, 0 to limit.
+    std::vector<std::int64_t> histogram;
+
+    fractal_stats() = default;
+    explicit fractal_stats(int limit) : 
+        min_iterations{limit}, histogram(limit+1) {}
+
+    // add a diverged point
+    void add(int iterations) {
+        if (iterations < min_iterations) min_iterations = iterations;
+        if (iterations > max_iterations) max_iterations = iterations;
+        diverged_count += 1;
+        histogram[iterations] += 1;
+    }
+
+    void merge(fractal_stats const &o);
+
+    // Number of diverged points with the given count, 0 if out of range.
+    std::int64_t count(int iterations) const {
+        if (iterations < 0 or iterations >= int(histogram.size()))
+            return 0;
+        return histogram[iterations];
+    }
 };
 
+// Cumulative distribution of the smoothed iteration count of the diverged
+// points. A point with n iterations has a smoothed count on (n-1, n], and
+// the points are taken to be spread evenly over that range.
+class iteration_cdf {
+    // cumulative_[n] = fraction of the points with at most n iterations
+    std::vector<double> cumulative_;
+
+  public:
+    iteration_cdf() = default;
+    explicit iteration_cdf(fractal_stats const &stats);
+
+    // fraction of the points with a smoothed count at or below smoothed.
+    double cdf(double smoothed) const;
+    // smoothed count at or below which the fraction p of the points are.
+    // The inverse of cdf().
+    double percentile(double p) const;
+};
 
 struct fractal_point_data {
     std::complex<double> last_value = 0.0;
     double last_modulus = 0.0;
     int iterations = 0;
     bool diverged = false;
+    // exterior distance estimate - only filled in if requested.
+    double distance = 0.0;
+    // minimum distance of the orbit to each trap in the meta data.
+    double traps[MAX_TRAPS] = {};
+    // length of the attracting cycle for points that did not diverge.
+    // 0 if no cycle was found or the period was not requested.
+    int period = 0;
+    // smoothing term. iterations + fraction is the smoothed count.
+    double fraction = 0.0;
+    // continuous iteration count - iterations + fraction for diverged
+    // points. Not stored, filled in when the point is read for coloring.
+    double smooth_iterations = 0.0;
 
     fractal_point_data() = default;
     fractal_point_data(fractal_point_data const &o) = default;
 };
 
-using point_row = fixed_array<fractal_point_data>;
+// One row of points, stored column-wise with one column per channel in the
+// schema. Channels not in the schema are left at their defaults by get()
+// and ignored by set().
+//
+// The columns are allocated back to back in schema order so the whole row
+// can be read or written as one block with data().
+//
+// A row can also be a view of columns owned by something else, e.g. a
+// mapped .fract file. Views have no data().
+//
+// Bit channels share bytes between neighboring points, so a row must only
+// be written by one thread at a time.
+class point_row {
+    int size_;
+    channel_schema schema_;
+    std::vector<unsigned char *> columns_;
+    std::unique_ptr<unsigned char[]> storage_;
+    std::size_t storage_size_ = 0;
+    std::shared_ptr<void> owner_;
+    int iterations_column_ = -1;
+    int diverged_column_ = -1;
+
+  public:
+    point_row(int size, channel_schema const &schema);
+    // view - owner is kept alive as long as the row.
+    point_row(int size, channel_schema const &schema,
+            std::vector<unsigned char *> columns, std::shared_ptr<void> owner);
+    point_row(point_row const &) = delete;
+
+    int size() const { return size_; }
+    channel_schema const &schema() const { return schema_; }
+
+    fractal_point_data get(int i) const;
+    void set(int i, fractal_point_data const &pd);
+
+    // fast access to the core channels.
+    int iterations(int i) const;
+    bool diverged(int i) const;
+
+    // raw column for schema entry k. Holds size()*count values of the
+    // channel type.
+    unsigned char *column(int k) { return columns_[k]; }
+    unsigned char const *column(int k) const { return columns_[k]; }
+
+    // all columns. nullptr for views.
+    unsigned char *data() { return storage_.get(); }
+    unsigned char const *data() const { return storage_.get(); }
+    std::size_t data_size() const { return storage_size_; }
+};
 
 using point_grid = fixed_array<std::shared_ptr<point_row>>;
 
@@ -5,38 +5,106 @@
 
 #include "fixed_array.hpp"
 
+#include <cstdint>
 #include <string>
 #include <fstream>
+#include <vector>
 
+class MappedFile;
+
+// Where a tile (band of rows) is in a version 2 .fract file
+struct tile_entry {
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+};
+
+// How the tiles of a version 2 .fract file are stored
+//    raw    - as the columns are in memory, usable in place
+//    packed - compressed with pack_channel()
+enum class tile_codec : std::uint32_t { raw = 0, packed = 1 };
 
 class FractalFile {
   private:
     std::string file_name_;
     fractal_meta_data metadata_;
     bool has_meta_ = false;
+    unsigned version_ = 0;
+    channel_schema schema_;
     std::shared_ptr<point_grid> rows_;
     std::fstream fstrm_;
     int row_count_ = 0;
 
+    // version 2 tiles
+    int rows_per_tile_ = 0;
+    std::vector<tile_entry> tiles_;
+    std::streampos meta_pos_;
+    std::streampos index_pos_;
+    std::vector<unsigned char> tile_buffer_;
+    std::vector<std::size_t> tile_offsets_;
+    tile_codec tile_codec_ = tile_codec::raw;
+    std::vector<unsigned char> packed_buffer_;
+
+    fractal_stats stats_;
+    bool has_stats_ = false;
+
   public:
     FractalFile(std::string file_name) noexcept : file_name_{file_name} {};
     ~FractalFile() = default;
 
+    // Must be called before add_metadata()
+    void set_tile_codec(tile_codec codec) { tile_codec_ = codec; }
+
     void add_metadata( fractal_meta_data const &fmd );
 
     void write_row(point_row const& rs);
 
+    // Written by finalize(). The min and max iterations of the meta data
+    // are replaced by the ones in the stats, so the rows may be written
+    // before the range is known.
+    void set_stats(fractal_stats const &stats) { stats_ = stats; has_stats_ = true; }
+
     void finalize();
 
     static std::unique_ptr<FractalFile> read_from_file(std::string file_name);
+
+    // The same as reading back the file that the rows and stats would be
+    // written to, without the file. The rows are shared, not copied.
+    static std::unique_ptr<FractalFile> from_memory(std::string file_name,
+            fractal_meta_data const &fmd, std::shared_ptr<point_grid> rows,
+            fractal_stats const &stats);
     static fractal_meta_data read_meta_data_from_file(std::string file_name);
+
+    // Open the file to be read a tile at a time with read_tile(), without
+    // reading the rows. Files from before version 2 have no tiles, so all
+    // of their rows are read, as by read_from_file().
+    static std::unique_ptr<FractalFile> open_tiles(std::string file_name);
+
+    // The tiles of a file opened with open_tiles(). Tile t holds the rows
+    // from t * rows_per_tile(). read_tile() may be called on several
+    // threads at once.
+    int rows_per_tile() const { return rows_per_tile_; }
+    int tile_count() const { return int(tiles_.size()); }
+    std::vector<std::shared_ptr<point_row>> read_tile(int t) const;
     
     fractal_meta_data get_meta_data() const;
+    // null for a file opened with open_tiles()
     std::shared_ptr<point_grid>  const & get_rows() const { return rows_; }
+    channel_schema const & get_schema() const { return schema_; }
+
+    // Only version 2.2 and later files have stats
+    bool has_stats() const { return has_stats_; }
+    fractal_stats const & get_stats() const { return stats_; }
 
   private:
     void read_meta_data();
     void read_data();
+    void read_tiles();
+    void decode_tile(int t, unsigned char *data, std::shared_ptr<void> owner,
+            std::shared_ptr<point_row> *rows) const;
+    void write_tile();
+    void pad_to(std::size_t alignment);
+    void check_data_size(MappedFile const &mapping, std::size_t data_start,
+            std::size_t row_size) const;
 
 };
 
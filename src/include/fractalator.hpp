@@ -3,6 +3,9 @@
 
 #include "compute.hpp"
 
+#include <string>
+#include <vector>
+
 struct fractalator_options {
     std::string output_file;
     std::string aspect;
@@ -20,13 +23,46 @@ struct fractalator_options {
     int    limit;
     bool   debug = false;
     int    jobs;
+    bool   distance = false;
+    std::vector<orbit_trap> traps;
+    // optional channels to compute. --distance and --trap add to these.
+    channel_set channels = DEFAULT_CHANNELS;
+    // store the points with the compact encoding
+    bool   compact = false;
+    // pack the tiles of the .fract file
+    bool   compress = false;
 
 };
 
+orbit_options make_orbit_options(fractalator_options const &clopts);
+
+// meta data for the file. max/min iterations are filled in from the
+// arguments.
+fractal_meta_data make_meta_data(fractalator_options const &clopts,
+        int max_iter = 0, int min_iter = 0);
+
+// What the compute engine is given
+fractal_params make_fractal_params(fractalator_options const &clopts);
+
+// Compute and write the .fract file
 void compute_fractal(fractalator_options const &clopts);
 
+// Compute without writing the file. stats is filled in.
+std::shared_ptr<point_grid> compute_fractal(fractalator_options const &clopts,
+        fractal_stats &stats);
+
+// Compute the fractal, writing the rows to the .fract file as they are
+// done. stats is filled in. Only the rows waiting to be written are ever
+// in memory.
+//
+// Both this and write_fractal_file write the file under a temporary name
+// and rename it when it is complete, so a partly written file is never
+// taken for a good one.
+void compute_and_write_fractal(fractalator_options const &clopts,
+        fractal_stats &stats);
 
+// Write computed rows to the .fract file
 void write_fractal_file(fractalator_options const &clopts, 
-        std::shared_ptr<point_grid> data) ;
+        std::shared_ptr<point_grid> data, fractal_stats const &stats);
 
 #endif
@@ -0,0 +1,49 @@
+#if !defined(MANDEL_GRADIENT_HPP_)
+#define MANDEL_GRADIENT_HPP_
+
+#include "pixel.hpp"
+
+#include <vector>
+
+// A color gradient given by color stops on [0, 1], linearly interpolated
+// in RGB between the stops and held outside them.
+//
+// The gradient is baked into a lookup table whenever a stop is added, so
+// at() is a single table lookup. The stops are meant to be set up once
+// and at() called for every pixel, possibly from several threads.
+class gradient {
+  public:
+    static const int LUT_SIZE = 4096;
+
+    void add_stop(double t, pixel color);
+
+    // t is clamped to [0, 1]. Black if there are no stops.
+    pixel at(double t) const {
+        if (lut_.empty())
+            return pixel{};
+        if (not (t > 0.0))
+            return lut_.front();
+        if (t >= 1.0)
+            return lut_.back();
+        return lut_[int(t * (LUT_SIZE - 1) + 0.5)];
+    }
+
+    // Only the fractional part of t is used, so the gradient repeats.
+    pixel cycle(double t) const;
+
+    int stop_count() const { return int(stops_.size()); }
+
+  private:
+    struct stop {
+        double t;
+        pixel color;
+    };
+
+    // sorted by t
+    std::vector<stop> stops_;
+    std::vector<pixel> lut_;
+
+    void bake();
+};
+
+#endif
@@ -0,0 +1,28 @@
+#if !defined(MANDEL_IMAGE_FILE_HPP_)
+#define MANDEL_IMAGE_FILE_HPP_
+
+#include "pixel.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Where the colored rows go. The rows are written in order, bottom row
+// first.
+class ImageFile {
+  public:
+    virtual ~ImageFile() = default;
+
+    virtual void write_row(std::vector<pixel> const & data) = 0;
+};
+
+// The format is picked by the file name - a ".ppm" name gets a binary
+// PPM file, anything else a BMP file. BMP files are limited to 4 GB, PPM
+// files have no limit.
+std::unique_ptr<ImageFile> make_image_file(std::string const &file_name,
+        int height, int width);
+
+// Throws if the image is too large for the format file_name picks.
+void check_image_size(std::string const &file_name, int height, int width);
+
+#endif
@@ -0,0 +1,27 @@
+#if !defined(MAPPED_FILE_HPP_)
+#define MAPPED_FILE_HPP_
+
+#include <cstddef>
+#include <string>
+
+// A whole file mapped into memory.
+//
+// The mapping is private, so the memory may be written but the changes
+// never reach the file.
+class MappedFile {
+    std::string file_name_;
+    unsigned char *data_ = nullptr;
+    std::size_t size_ = 0;
+
+  public:
+    // throws std::runtime_error if the file cannot be mapped.
+    MappedFile(std::string file_name);
+    MappedFile(MappedFile const &) = delete;
+    ~MappedFile();
+
+    unsigned char *data() { return data_; }
+    unsigned char const *data() const { return data_; }
+    std::size_t size() const { return size_; }
+};
+
+#endif
@@ -0,0 +1,114 @@
+#if !defined(MANDEL_ORDERED_PIPELINE_HPP_)
+#define MANDEL_ORDERED_PIPELINE_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Call produce(worker, i) for each i in [0, count) on workers threads and
+// hand the results to consume(i, item) on the calling thread, in order of
+// i, while the workers go on with the following items.
+//
+// Finished items wait in a reorder buffer of depth slots, and a worker
+// does not start item i until item i - depth has been taken from it. So
+// no more than depth items (plus the one being consumed) are held at once,
+// whatever count is.
+//
+// workers <= 0 produces and consumes each item in turn on the calling
+// thread (as worker 0). The first exception thrown by produce or consume
+// stops the pipeline and is rethrown once the workers have finished.
+template<class Produce, class Consume>
+void ordered_pipeline(int count, int workers, int depth,
+        Produce produce, Consume consume) {
+
+    if (workers <= 0) {
+        for (int i = 0; i < count; ++i)
+            consume(i, produce(0, i));
+        return;
+    }
+
+    using item_type = std::invoke_result_t<Produce &, int, int>;
+
+    depth = std::max(depth, workers);
+
+    std::vector<std::optional<item_type>> slots(depth);
+    int next = 0;       // next item for a worker to start
+    int taken = 0;      // items taken from the buffer by the consumer
+    bool stop = false;
+    std::exception_ptr error;
+
+    std::mutex mtx;
+    std::condition_variable slot_free;
+    std::condition_variable item_ready;
+
+    auto fail = [&]() {
+        std::lock_guard<std::mutex> l(mtx);
+        if (not error)
+            error = std::current_exception();
+        stop = true;
+        slot_free.notify_all();
+        item_ready.notify_all();
+    };
+
+    auto work = [&](int w) {
+        while (true) {
+            int i;
+            {
+                std::unique_lock<std::mutex> l(mtx);
+                slot_free.wait(l, [&]() {
+                        return stop or next >= count or next < taken + depth; });
+                if (stop or next >= count)
+                    return;
+                i = next++;
+            }
+
+            try {
+                auto item = produce(w, i);
+                std::lock_guard<std::mutex> l(mtx);
+                slots[i % depth].emplace(std::move(item));
+            } catch (...) {
+                fail();
+                return;
+            }
+            item_ready.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; ++w)
+        threads.emplace_back(work, w);
+
+    try {
+        for (int i = 0; i < count; ++i) {
+            std::optional<item_type> item;
+            {
+                std::unique_lock<std::mutex> l(mtx);
+                auto &slot = slots[i % depth];
+                item_ready.wait(l, [&]() { return stop or slot.has_value(); });
+                if (stop)
+                    break;
+                item = std::move(slot);
+                slot.reset();
+                taken = i + 1;
+            }
+            slot_free.notify_all();
+
+            consume(i, std::move(*item));
+        }
+    } catch (...) {
+        fail();
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+#endif
@@ -0,0 +1,55 @@
+#if !defined(MANDEL_PARALLEL_FOR_HPP_)
+#define MANDEL_PARALLEL_FOR_HPP_
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of threads to use when jobs is not given (<= 0)
+inline int default_jobs(int jobs = 0) {
+    if (jobs > 0)
+        return jobs;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Call f(begin, end) for contiguous chunks of [0, count), one chunk per
+// thread. The first exception thrown by f is rethrown after all the
+// threads have finished.
+template<class F>
+void parallel_for(int count, int jobs, F f) {
+    jobs = std::min(default_jobs(jobs), count);
+
+    if (jobs <= 1) {
+        if (count > 0)
+            f(0, count);
+        return;
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mtx;
+    std::vector<std::thread> threads;
+
+    for (int j = 0; j < jobs; ++j) {
+        int begin = int(static_cast<long long>(count) * j / jobs);
+        int end   = int(static_cast<long long>(count) * (j+1) / jobs);
+        threads.emplace_back([&, begin, end]() {
+            try {
+                f(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> l(error_mtx);
+                if (not error)
+                    error = std::current_exception();
+            }
+        });
+    }
+
+    for (auto &t : threads)
+        t.join();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+#endif
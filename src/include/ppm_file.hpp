@@ -0,0 +1,36 @@
+#if !defined(MANDEL_PPM_FILE_HPP_)
+#define MANDEL_PPM_FILE_HPP_
+
+#include "image_file.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// Binary PPM (P6) image. The header holds the width and height as text,
+// so unlike BMP there is no limit on the file size.
+//
+// PPM stores the top row first. The rows are written bottom row first
+// (as for BMP), so each is put at its place from the end of the file.
+class PPMFile : public ImageFile {
+    std::string file_name_;
+    int height_;
+    int width_;
+    std::ofstream out_stream_;
+    std::uint64_t data_offset_ = 0;
+    std::vector<unsigned char> buffer_;
+    int current_row_ = 0;
+
+  public:
+
+    PPMFile(std::string file_name, int height, int width) noexcept :
+        file_name_(std::move(file_name)), height_(height), width_(width) {}
+
+    void write_row(std::vector<pixel> const & data) override;
+
+  private:
+
+    void initialize_file();
+};
+
+#endif
@@ -5,7 +5,10 @@
 #define AS_USE_FLOAT 0
 #include <angelscript.h>
 
+#include <cstdint>
+#include <map>
 #include <string>
+#include <vector>
 
 
 class ScriptEngine {
@@ -16,23 +19,57 @@ class ScriptEngine {
     ~ScriptEngine();
     void initialize(std::string const &script);
 
+    // Compile the script to native code with jit (which must outlive the
+    // engine). Must be called before initialize(). By default the JIT
+    // built in with MANDEL_SCRIPT_JIT_DIR is used, if there is one.
+    void set_jit_compiler(asIJITCompiler *jit) { jit_ = jit; }
+
+    // true if a JIT compiler is built in
+    static bool has_builtin_jit();
+
+    // Keep the compiled script in dir, and load it from there instead of
+    // compiling when neither the script (and its includes) nor the
+    // registered interface have changed. Must be called before
+    // initialize(). Empty (the default) turns the cache off.
+    void set_cache_dir(std::string dir) { cache_dir_ = std::move(dir); }
+
     asIScriptFunction *find_function(std::string const& func_decl);
 
     asIScriptContext* prepare_context(std::string const& func_decl);
     asIScriptContext* prepare_context(asIScriptFunction *func);
     void print_exception_info();
+    void print_exception_info(asIScriptContext *ctx);
+
+    // true if the function was declared with the given metadata, e.g.
+    //    [parallel]
+    //    color colorize(point_data@ p)
+    bool has_metadata(asIScriptFunction *func, std::string const &tag) const;
 
   protected:
     asIScriptEngine *engine_ = nullptr;
     asIScriptContext *context_ = nullptr;
 
+    // metadata given for each function in the script
+    std::map<asIScriptFunction const *, std::vector<std::string>> metadata_;
+
     bool execute_context();
+    bool execute_context(asIScriptContext *ctx);
 
     asIScriptModule *get_module();
 
   private:
+    std::string cache_dir_;
+
+    asIJITCompiler *jit_ = nullptr;
+    // the built in JIT, if it is being used
+    asIJITCompiler *builtin_jit_ = nullptr;
+
     virtual void _register_interface(asIScriptEngine* engine) {} 
 
+    std::uint64_t interface_hash() const;
+    bool load_cached_module(std::string const &path, std::uint64_t key);
+    void save_cached_module(std::string const &path, std::uint64_t key);
+
 
 
 };
@@ -0,0 +1,28 @@
+#if !defined(MANDEL_TILE_CODEC_HPP_)
+#define MANDEL_TILE_CODEC_HPP_
+
+#include "fractal_data.hpp"
+
+#include <cstddef>
+#include <vector>
+
+// Lossless packing of the channel blocks of a .fract tile.
+//
+// Each value is turned into a difference from the value before it - a
+// zigzag encoded delta for integer channels, the xor of the bit patterns
+// for floating point channels. Most of these are zero inside the set and
+// small outside of it. Runs of zeros are written as a single count.
+// Blocks that do not get smaller are stored as they are.
+
+// Append the packed form of size bytes of the channel's columns to out.
+void pack_channel(channel_desc const &ch, unsigned char const *in,
+        std::size_t size, std::vector<unsigned char> &out);
+
+// Unpack size bytes of the channel's columns from [in, in_end) into out.
+// Returns the position after the packed data. Throws std::runtime_error
+// if the data is corrupt.
+unsigned char const *unpack_channel(channel_desc const &ch,
+        unsigned char const *in, unsigned char const *in_end,
+        unsigned char *out, std::size_t size);
+
+#endif
@@ -29,7 +29,8 @@ class work_queue {
 
         work_available_.wait(l, [this](){return (all_done_ or (queue_.size() > 0)); });
 
-        if (all_done_) {
+        // finish what is queued before reporting done
+        if (queue_.size() == 0) {
             return {false, WorkItem()};
         }
 
@@ -2,12 +2,18 @@
 
 #include <iostream>
 #include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
 
 
 void BMPFile::initialize_file() {
 
     if (initialized_) return;
 
+    check_size(height_, width_);
+
     out_stream_ = new std::ofstream{};
     // throw an exception for most errors
     out_stream_->exceptions(std::ofstream::failbit | std::ofstream::badbit );
@@ -71,12 +77,24 @@ struct image_header {
     std::uint32_t important_colors = 0; // generally ignored
 }__attribute__((packed));
 
+std::uint64_t BMPFile::file_size(int height, int width) {
+    return sizeof(file_header) + sizeof(image_header) +
+        std::uint64_t(height) * std::uint64_t(width) * 4;
+}
+
+void BMPFile::check_size(int height, int width) {
+    if (file_size(height, width) > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("A " + std::to_string(width) + "x" + 
+                std::to_string(height) + " image is too large for a BMP file (4 GB at most)");
+    }
+}
+
 void BMPFile::_write_file_header() {
     file_header fh;
 
     fh.data_offset = sizeof(file_header) + sizeof(image_header);
 
-    fh.file_size = fh.data_offset + (height_ * width_ * 4);
+    fh.file_size = std::uint32_t(file_size(height_, width_));
 
     out_stream_->write(reinterpret_cast<char*>(&fh), sizeof(fh));
 
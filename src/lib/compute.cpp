@@ -1,11 +1,55 @@
 #include "compute.hpp"
 
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <iostream>
-#include <list>
+#include <limits>
+#include <sstream>
+#include <utility>
+
+// Distance from z to the trap. rotation is the trap angle as a unit
+// complex number, conjugated, so that multiplying by it rotates the trap
+// onto the real axis.
+//
+// For point traps this is the *squared* distance so that the sqrt can be
+// kept out of the loop. Use finish_trap_distance() on the minimum.
+inline double trap_distance(orbit_trap const &trap, 
+        std::complex<double> rotation, std::complex<double> z) {
+
+    auto offset = z - trap.center;
+
+    switch (trap.kind) {
+        case trap_kind::point :
+            return std::norm(offset);
+        case trap_kind::line :
+            return std::fabs((offset * rotation).imag());
+        case trap_kind::cross : {
+            auto rotated = offset * rotation;
+            return std::min(std::fabs(rotated.real()), std::fabs(rotated.imag()));
+        }
+    }
+
+    return 0.0;
+}
 
+inline double finish_trap_distance(orbit_trap const &trap, double d) {
+    return (trap.kind == trap_kind::point) ? std::sqrt(d) : d;
+}
+
+// Orbit points closer than this fraction of the sample spacing are
+// considered to be the same point when checking for periodicity.
+const double PERIOD_TOLERANCE_SCALE = 1.0e-5;
+
+template<channel_set Channels>
 fractal_point_data mandelbrot_test(std::complex<double> test_point, 
-        int limit, double escape_radius) {
+        int limit, double escape_radius, orbit_options const &opts) {
+
+    constexpr bool WithModulus  = Channels & channel_bit(channel_id::last_modulus);
+    constexpr bool WithDistance = Channels & channel_bit(channel_id::distance);
+    constexpr bool WithTraps    = Channels & channel_bit(channel_id::trap);
+    constexpr bool WithPeriod   = Channels & channel_bit(channel_id::period);
+    constexpr bool WithFraction = Channels & channel_bit(channel_id::fraction);
 
     // check that we aren't on the main cartiod
     // https://iquilezles.org/www/articles/mset_1bulb/mset1bulb.htm
@@ -13,140 +57,260 @@ fractal_point_data mandelbrot_test(std::complex<double> test_point,
     double test_val = 256*cnorm*cnorm - 96*cnorm + 32.0*test_point.real() - 3;
 
     fractal_point_data retval;
+    // derivative of the orbit with respect to the test point
+    std::complex<double> dz = 0.0;
+
+    std::complex<double> trap_rotation[MAX_TRAPS];
+    if constexpr (WithTraps) {
+        for (int t = 0; t < opts.trap_count; ++t) {
+            trap_rotation[t] = std::polar(1.0, -opts.traps[t].angle);
+        }
+    }
+
     if (test_val < 0.0) {
         retval.last_value = test_point;
-        retval.last_modulus = std::abs(test_point);
+        if constexpr (WithModulus) {
+            retval.last_modulus = std::abs(test_point);
+        }
         retval.diverged = false;
+        // The orbit is never computed, so only the first point (the
+        // test point itself) is checked against the traps.
+        if constexpr (WithTraps) {
+            for (int t = 0; t < opts.trap_count; ++t) {
+                retval.traps[t] = finish_trap_distance(opts.traps[t],
+                        trap_distance(opts.traps[t], trap_rotation[t], test_point));
+            }
+        }
+        // The main cardioid is where the period 1 cycle attracts.
+        if constexpr (WithPeriod) {
+            retval.period = 1;
+        }
         return retval;
     }
+
+    if constexpr (WithTraps) {
+        for (int t = 0; t < opts.trap_count; ++t) {
+            retval.traps[t] = std::numeric_limits<double>::infinity();
+        }
+    }
+
+    // Periodicity checking - Brent's cycle detection. The orbit is compared
+    // against a saved point which is moved forward at doubling intervals.
+    std::complex<double> saved_value = 0.0;
+    int saved_distance = 0;
+    int check_interval = 1;
+    double period_tolerance = opts.period_tolerance * opts.period_tolerance;
+
+    // Compare the squared modulus to avoid the sqrt in the loop.
+    double escape_norm = escape_radius * escape_radius;
     
     for (;retval.iterations < limit; ++retval.iterations) {
 
-        retval.last_value =  retval.last_value*retval.last_value + test_point;
+        if constexpr (WithDistance) {
+            dz = 2.0*retval.last_value*dz + 1.0;
+        }
 
-        retval.last_modulus = std::abs(retval.last_value);
+        retval.last_value =  retval.last_value*retval.last_value + test_point;
 
         // c.f. https://www.iquilezles.org/www/articles/mset_smooth/mset_smooth.htm
         // for why the 256
         // 
-        if (retval.last_modulus > escape_radius) {
+        if (std::norm(retval.last_value) > escape_norm) {
             retval.diverged = true;
+            if constexpr (WithModulus or WithDistance or WithFraction) {
+                double modulus = std::abs(retval.last_value);
+                if constexpr (WithModulus) {
+                    retval.last_modulus = modulus;
+                }
+                if constexpr (WithDistance) {
+                    // c.f. https://iquilezles.org/www/articles/distancefractals/distancefractals.htm
+                    retval.distance = 0.5 * modulus * std::log(modulus) / std::abs(dz);
+                }
+                if constexpr (WithFraction) {
+                    retval.fraction = std::log2(std::log2(escape_radius)) -
+                        std::log2(std::log2(modulus));
+                }
+            }
+            if constexpr (WithTraps) {
+                for (int t = 0; t < opts.trap_count; ++t) {
+                    retval.traps[t] = finish_trap_distance(opts.traps[t], retval.traps[t]);
+                }
+            }
             return retval;
         }
 
+        if constexpr (WithTraps) {
+            for (int t = 0; t < opts.trap_count; ++t) {
+                double d = trap_distance(opts.traps[t], trap_rotation[t], 
+                        retval.last_value);
+                if (d < retval.traps[t])
+                    retval.traps[t] = d;
+            }
+        }
+
+        if constexpr (WithPeriod) {
+            saved_distance += 1;
+            if (std::norm(retval.last_value - saved_value) < period_tolerance) {
+                // The orbit is in a cycle and will never diverge. Report it
+                // as if it ran out the limit.
+                retval.period = saved_distance;
+                retval.iterations = limit;
+                break;
+            }
+            if (saved_distance == check_interval) {
+                saved_value = retval.last_value;
+                saved_distance = 0;
+                check_interval *= 2;
+            }
+        }
 
     }
 
     retval.diverged = false;
+    if constexpr (WithModulus) {
+        retval.last_modulus = std::abs(retval.last_value);
+    }
+    if constexpr (WithTraps) {
+        for (int t = 0; t < opts.trap_count; ++t) {
+            retval.traps[t] = finish_trap_distance(opts.traps[t], retval.traps[t]);
+        }
+    }
     return retval;
 }
 
-void compute_slice(work_item wi) {
+template<channel_set Channels>
+void compute_slice_impl(work_item const &wi, fractal_stats &stats) {
     for (int index = wi.start_index; index < wi.end_index; ++index) {
         double real_double = wi.base_real + (wi.real_increment * index);
-        (*wi.output)[index] = mandelbrot_test({real_double, wi.base_img}, 
-                wi.limit, wi.escape_radius);
+        auto pd = mandelbrot_test<Channels>(
+                {real_double, wi.base_img}, wi.limit, wi.escape_radius,
+                wi.orbit);
+        wi.output->set(index, pd);
+        if (pd.diverged)
+            stats.add(pd.iterations);
     }
 }
 
-std::shared_ptr<point_grid> compute_fractal(fractal_params p) {
-    auto retval = std::make_shared<fixed_array<std::shared_ptr<point_row>>>(p.samples_img);
-
-    double real_increment = (p.bb_bottom_right.real() - p.bb_top_left.real()) / p.samples_real;
-    double img_increment = (p.bb_top_left.imag() - p.bb_bottom_right.imag()) / p.samples_img;
-
-    double base_real = p.bb_top_left.real();
-
-    for (int row = 0; row < p.samples_img; ++row) {
-        if (row % 100 == 0)
-            std::cout << "----------------- starting row = " << row << " ---\n";
-        
-        auto rs = std::make_shared<point_row>(p.samples_real);
-
-        double base_img = p.bb_bottom_right.imag() + ( img_increment * row );
-
-        compute_slice({rs, row, p.limit, 0, p.samples_real, 
-                base_img, base_real, real_increment, p.escape_radius});
-
-        (*retval)[row] = rs;
+// The channels that change the work done in the kernel. Every combination
+// of these gets its own instantiation.
+const channel_set KERNEL_CHANNELS = 
+        channel_bit(channel_id::last_modulus) |
+        channel_bit(channel_id::distance) |
+        channel_bit(channel_id::trap) |
+        channel_bit(channel_id::period) |
+        channel_bit(channel_id::fraction);
+
+// Spread the bits of index over the bits of KERNEL_CHANNELS
+constexpr channel_set kernel_channels_for(std::size_t index) {
+    channel_set retval = 0;
+    for (unsigned bit = 0; bit < 32; ++bit) {
+        if (KERNEL_CHANNELS & (channel_set{1} << bit)) {
+            if (index & 1) 
+                retval |= channel_set{1} << bit;
+            index >>= 1;
+        }
     }
-
     return retval;
 }
 
-/*---------------------------------------------
- * parallel land
- *---------------------------------------------*/
-
-// Producer - queues up work items
-void producer(fractal_params p, fractal_work_queue &wq, 
-        std::shared_ptr<point_grid> &data_array) {
-
-    double real_increment = (p.bb_bottom_right.real() - p.bb_top_left.real()) / p.samples_real;
-    double img_increment = (p.bb_top_left.imag() - p.bb_bottom_right.imag()) / p.samples_img;
-    double base_real = p.bb_top_left.real();
-
-    std::cerr << "Producer: escape = " << p.escape_radius << "\n";
-
-    for (int row = 0; row < p.samples_img; ++row) {
-        (*data_array)[row] = 
-            std::make_shared<point_row>(p.samples_real);
-
-        double base_img = p.bb_bottom_right.imag() + ( img_increment * row );
-
-        work_item wi = {(*data_array)[row], row, p.limit, 0, p.samples_real,
-            base_img, base_real, real_increment, p.escape_radius};
-
-        wq.add_work(wi);
+using slice_function = void (*)(work_item const &, fractal_stats &);
 
-        if (row % 100 == 0)
-            std::cerr << "Producer queued : " << row << "\n";
-    }
-
-    wq.set_all_done();
-    std::cerr << "Producer Shutting down\n";
+template<std::size_t... Index>
+constexpr std::array<slice_function, sizeof...(Index)> 
+make_slice_table(std::index_sequence<Index...>) {
+    return { &compute_slice_impl<kernel_channels_for(Index)>... };
 }
 
-// consumer - grabs work
-void consumer(int id, fractal_work_queue &wq) {
-    std::cerr << "Consumer " << id << " starting\n";
-    while(true) {
-        auto [ is_valid, wi ] = wq.get_work();
-        if (not is_valid) {
-            std::cerr << "Consumer " << id << " shutting down\n";
-            return;
+const auto slice_table = make_slice_table(std::make_index_sequence<32>{});
+
+void compute_slice(work_item wi, fractal_stats &stats) {
+    channel_set channels = wi.orbit.channels;
+    if (wi.orbit.trap_count == 0)
+        channels &= ~channel_bit(channel_id::trap);
+
+    // gather the kernel bits back into an index
+    std::size_t index = 0;
+    std::size_t index_bit = 1;
+    for (unsigned bit = 0; bit < 32; ++bit) {
+        if (KERNEL_CHANNELS & (channel_set{1} << bit)) {
+            if (channels & (channel_set{1} << bit))
+                index |= index_bit;
+            index_bit <<= 1;
         }
-        //std::cerr << "Consumer " << id << " working on " << wi.row_number << "\n";
-
-        compute_slice(wi);
     }
-}
 
+    slice_table[index](wi, stats);
+}
 
+orbit_trap parse_orbit_trap(std::string const &spec) {
+    auto colon = spec.find(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error("Trap '" + spec + "' is missing the kind");
+
+    orbit_trap retval;
+    auto kind = spec.substr(0, colon);
+    int min_values = 2;
+    int max_values = 3;
+
+    if (kind == "point") {
+        retval.kind = trap_kind::point;
+        max_values = 2;
+    } else if (kind == "line") {
+        retval.kind = trap_kind::line;
+        min_values = 3;
+    } else if (kind == "cross") {
+        retval.kind = trap_kind::cross;
+    } else {
+        throw std::runtime_error("Unknown trap kind '" + kind + "'");
+    }
 
-/* --------------------------------------------
- * main routine
- * --------------------------------------------*/
+    double values[3] = { 0.0, 0.0, 0.0 };
+    int value_count = 0;
+    std::istringstream iss(spec.substr(colon+1));
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (value_count >= max_values)
+            throw std::runtime_error("Too many values for trap '" + spec + "'");
+        std::size_t end;
+        try {
+            values[value_count] = std::stod(item, &end);
+        } catch (std::logic_error &) {
+            end = 0;
+        }
+        if (end == 0 or end != item.size())
+            throw std::runtime_error("Invalid number '" + item + 
+                    "' in trap '" + spec + "'");
+        value_count += 1;
+    }
 
-std::shared_ptr<point_grid> compute_fractal(fractal_params p, 
-                        fractal_work_queue &wq, int jobs) {
+    if (value_count < min_values)
+        throw std::runtime_error("Too few values for trap '" + spec + "'");
 
-    // Toplevel array of arrays
-    auto retval = std::make_shared<fixed_array<std::shared_ptr<point_row>>>(p.samples_img);
+    retval.center = { values[0], values[1] };
+    retval.angle = values[2] * M_PI / 180.0;
 
-    std::thread pd(producer,p, std::ref(wq), std::ref(retval));
+    return retval;
+}
 
-    std::list<std::thread> consumers;
+row_computer::row_computer(fractal_params p) : p_(p) {
+    real_increment_ = (p_.bb_bottom_right.real() - p_.bb_top_left.real()) / p_.samples_real;
+    img_increment_ = (p_.bb_top_left.imag() - p_.bb_bottom_right.imag()) / p_.samples_img;
 
-    for (int i = 0; i < jobs; ++i) {
-        consumers.emplace_back(consumer, i, std::ref(wq));
-    }
+    p_.orbit.period_tolerance = PERIOD_TOLERANCE_SCALE * real_increment_;
+    schema_ = make_schema(p_.orbit.channels, p_.orbit.trap_count,
+            p_.orbit.encoding, p_.limit);
+}
 
-    pd.join();
+work_item row_computer::make_work_item(int row, std::shared_ptr<point_row> output) const {
+    double base_img = p_.bb_bottom_right.imag() + ( img_increment_ * row );
 
-    for( auto &c : consumers) {
-        c.join();
-    }
+    return {output, row, p_.limit, 0, p_.samples_real,
+            base_img, p_.bb_top_left.real(), real_increment_, p_.escape_radius,
+            p_.orbit};
+}
 
-    return retval;
+std::shared_ptr<point_row> row_computer::compute_row(int row, fractal_stats &stats) const {
+    auto rs = std::make_shared<point_row>(p_.samples_real, schema_);
+    compute_slice(make_work_item(row, rs), stats);
+    return rs;
 }
@@ -0,0 +1,405 @@
+#include "fractal_data.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+
+static char const * const channel_name_list[CHANNEL_ID_COUNT] = {
+    "iterations",
+    "diverged",
+    "last_value",
+    "last_modulus",
+    "distance",
+    "period",
+    "traps",
+    "fraction",
+};
+
+channel_set encoding_channels(channel_set channels, point_encoding encoding) {
+    channels |= CORE_CHANNELS;
+
+    if (encoding == point_encoding::compact) {
+        channels &= ~(channel_bit(channel_id::last_value) |
+                channel_bit(channel_id::last_modulus));
+        channels |= channel_bit(channel_id::fraction);
+    }
+
+    return channels;
+}
+
+channel_schema make_schema(channel_set channels, int trap_count,
+        point_encoding encoding, int limit) {
+    channel_schema retval;
+
+    channels = encoding_channels(channels, encoding);
+
+    auto has = [channels](channel_id id) {
+        return (channels & channel_bit(id)) != 0;
+    };
+
+    bool compact = (encoding == point_encoding::compact);
+
+    channel_type int_type  = channel_type::i32;
+    channel_type real_type = channel_type::f64;
+    channel_type flag_type = channel_type::u8;
+
+    if (compact) {
+        int_type  = (limit < 0xffff) ? channel_type::u16 : channel_type::u32;
+        real_type = channel_type::f32;
+        flag_type = channel_type::bit;
+    }
+
+    // The first four are in the order of the original .fract record.
+    if (has(channel_id::last_value))
+        retval.push_back({channel_id::last_value, channel_type::c128});
+    if (has(channel_id::last_modulus))
+        retval.push_back({channel_id::last_modulus, channel_type::f64});
+
+    retval.push_back({channel_id::iterations, int_type});
+    retval.push_back({channel_id::diverged, flag_type});
+
+    if (has(channel_id::distance))
+        retval.push_back({channel_id::distance, real_type});
+    if (has(channel_id::trap) and trap_count > 0)
+        retval.push_back({channel_id::trap, real_type,
+                std::uint8_t(trap_count)});
+    if (has(channel_id::period))
+        retval.push_back({channel_id::period, int_type});
+    if (has(channel_id::fraction))
+        retval.push_back({channel_id::fraction, channel_type::f32});
+
+    return retval;
+}
+
+channel_set schema_channels(channel_schema const &schema) {
+    channel_set retval = 0;
+    for (auto const &ch : schema) {
+        retval |= channel_bit(ch.id);
+    }
+    return retval;
+}
+
+point_encoding schema_encoding(channel_schema const &schema) {
+    for (auto const &ch : schema) {
+        if (ch.id == channel_id::diverged)
+            return (ch.type == channel_type::bit) ?
+                point_encoding::compact : point_encoding::full;
+    }
+    return point_encoding::full;
+}
+
+int channel_type_size(channel_type type) {
+    switch (type) {
+        case channel_type::u8 :   return 1;
+        case channel_type::i32 :  return 4;
+        case channel_type::f64 :  return 8;
+        case channel_type::c128 : return 16;
+        case channel_type::u16 :  return 2;
+        case channel_type::u32 :  return 4;
+        case channel_type::f32 :  return 4;
+        case channel_type::bit :  return 0;
+    }
+
+    throw std::runtime_error("Unknown channel type");
+}
+
+int schema_record_size(channel_schema const &schema) {
+    int retval = 0;
+    for (auto const &ch : schema) {
+        if (ch.type == channel_type::bit)
+            throw std::runtime_error("Bit channels have no record size");
+        retval += channel_type_size(ch.type) * ch.count;
+    }
+    return retval;
+}
+
+std::size_t column_size(channel_desc const &ch, int size) {
+    if (ch.type == channel_type::bit)
+        return (std::size_t(size) * ch.count + 7) / 8;
+
+    return std::size_t(channel_type_size(ch.type)) * ch.count * size;
+}
+
+double modulus_from_fraction(double fraction, double escape_radius) {
+    // fraction = log2(log2(escape)) - log2(log2(modulus))
+    return std::exp2(std::exp2(std::log2(std::log2(escape_radius)) - fraction));
+}
+
+channel_set parse_channels(std::string const &names) {
+    channel_set retval = 0;
+
+    std::istringstream iss(names);
+    std::string name;
+    while (std::getline(iss, name, ',')) {
+        if (name == "" or name == "none")
+            continue;
+
+        bool found = false;
+        for (int i = 0; i < CHANNEL_ID_COUNT; ++i) {
+            if (name == channel_name_list[i]) {
+                retval |= channel_bit(channel_id(i));
+                found = true;
+                break;
+            }
+        }
+        if (not found)
+            throw std::runtime_error("Unknown channel '" + name + "'");
+    }
+
+    return retval;
+}
+
+std::string channel_names(channel_set channels) {
+    std::string retval;
+    for (int i = 0; i < CHANNEL_ID_COUNT; ++i) {
+        if (channels & channel_bit(channel_id(i))) {
+            if (retval.size() > 0)
+                retval += ",";
+            retval += channel_name_list[i];
+        }
+    }
+    return retval;
+}
+
+void fractal_stats::merge(fractal_stats const &o) {
+    if (histogram.size() < o.histogram.size())
+        histogram.resize(o.histogram.size());
+
+    for (std::size_t i = 0; i < o.histogram.size(); ++i) {
+        histogram[i] += o.histogram[i];
+    }
+
+    min_iterations = std::min(min_iterations, o.min_iterations);
+    max_iterations = std::max(max_iterations, o.max_iterations);
+    diverged_count += o.diverged_count;
+}
+
+iteration_cdf::iteration_cdf(fractal_stats const &stats) :
+        cumulative_(stats.histogram.size()) {
+
+    double total = stats.diverged_count > 0 ? double(stats.diverged_count) : 1.0;
+    std::int64_t running = 0;
+    for (std::size_t n = 0; n < stats.histogram.size(); ++n) {
+        running += stats.histogram[n];
+        cumulative_[n] = running / total;
+    }
+}
+
+double iteration_cdf::cdf(double smoothed) const {
+    if (cumulative_.empty() or smoothed <= -1.0)
+        return 0.0;
+
+    double top = double(cumulative_.size() - 1);
+    if (smoothed >= top)
+        return cumulative_.back();
+
+    // smoothed is in the range of bucket n
+    int n = int(std::ceil(smoothed));
+    double below = (n > 0) ? cumulative_[n-1] : 0.0;
+    return below + (cumulative_[n] - below) * (smoothed - (n - 1));
+}
+
+double iteration_cdf::percentile(double p) const {
+    if (cumulative_.empty())
+        return 0.0;
+
+    // for p = 0 skip the empty buckets at the start
+    auto pos = (p <= 0.0) ?
+        std::upper_bound(cumulative_.begin(), cumulative_.end(), 0.0) :
+        std::lower_bound(cumulative_.begin(), cumulative_.end(), p);
+    if (pos == cumulative_.end())
+        return double(cumulative_.size() - 1);
+
+    int n = int(pos - cumulative_.begin());
+    double below = (n > 0) ? cumulative_[n-1] : 0.0;
+    if (*pos <= below)
+        return double(n);
+
+    return (n - 1) + (p - below) / (*pos - below);
+}
+
+/*---------------------------------------------
+ * point_row
+ *---------------------------------------------*/
+
+template<class T> T load(unsigned char const *p) {
+    T retval;
+    std::memcpy(&retval, p, sizeof(T));
+    return retval;
+}
+
+template<class T> void store(unsigned char *p, T value) {
+    std::memcpy(p, &value, sizeof(T));
+}
+
+// Value n of a numeric column, whatever its type
+static double load_number(channel_type type, unsigned char const *column, int n) {
+    switch (type) {
+        case channel_type::u8 :  return column[n];
+        case channel_type::i32 : return load<std::int32_t>(column + n*4);
+        case channel_type::f64 : return load<double>(column + n*8);
+        case channel_type::u16 : return load<std::uint16_t>(column + n*2);
+        case channel_type::u32 : return load<std::uint32_t>(column + n*4);
+        case channel_type::f32 : return load<float>(column + n*4);
+        case channel_type::bit : return (column[n/8] >> (n%8)) & 1;
+        case channel_type::c128 : break;
+    }
+
+    throw std::runtime_error("Channel type is not a number");
+}
+
+static void store_number(channel_type type, unsigned char *column, int n,
+        double value) {
+    switch (type) {
+        case channel_type::u8 :  column[n] = std::uint8_t(value); return;
+        case channel_type::i32 : store<std::int32_t>(column + n*4, value); return;
+        case channel_type::f64 : store<double>(column + n*8, value); return;
+        case channel_type::u16 : store<std::uint16_t>(column + n*2, value); return;
+        case channel_type::u32 : store<std::uint32_t>(column + n*4, value); return;
+        case channel_type::f32 : store<float>(column + n*4, value); return;
+        case channel_type::bit :
+            if (value != 0.0)
+                column[n/8] |= std::uint8_t(1 << (n%8));
+            else
+                column[n/8] &= std::uint8_t(~(1 << (n%8)));
+            return;
+        case channel_type::c128 : break;
+    }
+
+    throw std::runtime_error("Channel type is not a number");
+}
+
+point_row::point_row(int size, channel_schema const &schema) :
+        size_{size}, schema_{schema} {
+
+    for (auto const &ch : schema_) {
+        storage_size_ += column_size(ch, size_);
+    }
+
+    storage_.reset(new unsigned char[storage_size_]());
+
+    auto *next = storage_.get();
+    for (auto const &ch : schema_) {
+        if (ch.id == channel_id::iterations)
+            iterations_column_ = columns_.size();
+        else if (ch.id == channel_id::diverged)
+            diverged_column_ = columns_.size();
+
+        columns_.push_back(next);
+        next += column_size(ch, size_);
+    }
+
+    if (iterations_column_ < 0 or diverged_column_ < 0)
+        throw std::runtime_error("Schema is missing the core channels");
+}
+
+point_row::point_row(int size, channel_schema const &schema,
+        std::vector<unsigned char *> columns, std::shared_ptr<void> owner) :
+        size_{size}, schema_{schema}, columns_{std::move(columns)},
+        owner_{std::move(owner)} {
+
+    if (columns_.size() != schema_.size())
+        throw std::runtime_error("Wrong number of columns for the schema");
+
+    for (std::size_t k = 0; k < schema_.size(); ++k) {
+        if (schema_[k].id == channel_id::iterations)
+            iterations_column_ = k;
+        else if (schema_[k].id == channel_id::diverged)
+            diverged_column_ = k;
+    }
+
+    if (iterations_column_ < 0 or diverged_column_ < 0)
+        throw std::runtime_error("Schema is missing the core channels");
+}
+
+fractal_point_data point_row::get(int i) const {
+    fractal_point_data retval;
+
+    for (std::size_t k = 0; k < schema_.size(); ++k) {
+        auto const &ch = schema_[k];
+        auto const *column = columns_[k];
+
+        switch (ch.id) {
+            case channel_id::iterations :
+                retval.iterations = int(load_number(ch.type, column, i));
+                break;
+            case channel_id::diverged :
+                retval.diverged = load_number(ch.type, column, i) != 0.0;
+                break;
+            case channel_id::last_value :
+                retval.last_value = load<std::complex<double>>(column +
+                        std::size_t(i)*sizeof(std::complex<double>));
+                break;
+            case channel_id::last_modulus :
+                retval.last_modulus = load_number(ch.type, column, i);
+                break;
+            case channel_id::distance :
+                retval.distance = load_number(ch.type, column, i);
+                break;
+            case channel_id::period :
+                retval.period = int(load_number(ch.type, column, i));
+                break;
+            case channel_id::trap :
+                for (int t = 0; t < ch.count; ++t) {
+                    retval.traps[t] = load_number(ch.type, column, i*ch.count + t);
+                }
+                break;
+            case channel_id::fraction :
+                retval.fraction = load_number(ch.type, column, i);
+                break;
+        }
+    }
+
+    return retval;
+}
+
+void point_row::set(int i, fractal_point_data const &pd) {
+
+    for (std::size_t k = 0; k < schema_.size(); ++k) {
+        auto const &ch = schema_[k];
+        auto *column = columns_[k];
+
+        switch (ch.id) {
+            case channel_id::iterations :
+                store_number(ch.type, column, i, pd.iterations);
+                break;
+            case channel_id::diverged :
+                store_number(ch.type, column, i, pd.diverged ? 1.0 : 0.0);
+                break;
+            case channel_id::last_value :
+                store(column + std::size_t(i)*sizeof(std::complex<double>),
+                        pd.last_value);
+                break;
+            case channel_id::last_modulus :
+                store_number(ch.type, column, i, pd.last_modulus);
+                break;
+            case channel_id::distance :
+                store_number(ch.type, column, i, pd.distance);
+                break;
+            case channel_id::period :
+                store_number(ch.type, column, i, pd.period);
+                break;
+            case channel_id::trap :
+                for (int t = 0; t < ch.count; ++t) {
+                    store_number(ch.type, column, i*ch.count + t, pd.traps[t]);
+                }
+                break;
+            case channel_id::fraction :
+                store_number(ch.type, column, i, pd.fraction);
+                break;
+        }
+    }
+}
+
+int point_row::iterations(int i) const {
+    return int(load_number(schema_[iterations_column_].type,
+                columns_[iterations_column_], i));
+}
+
+bool point_row::diverged(int i) const {
+    return load_number(schema_[diverged_column_].type,
+            columns_[diverged_column_], i) != 0.0;
+}
@@ -1,11 +1,77 @@
 #include "fractal_file.hpp"
+#include "mapped_file.hpp"
+#include "parallel_for.hpp"
+#include "tile_codec.hpp"
 
 #include <cereal/archives/binary.hpp>
 #include <cereal/types/complex.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 const unsigned SIGNATURE = 0x41434652;
-const unsigned VERSION   = 0x00010001;
+const unsigned VERSION   = 0x00020002;
+
+// Versions with changes to the header or layout
+const unsigned VERSION_STATS    = 0x00020002;
+const unsigned VERSION_CODEC    = 0x00020001;
+const unsigned VERSION_TILED    = 0x00020000;
+const unsigned VERSION_COLUMNS  = 0x00010005;
+const unsigned VERSION_SCHEMA   = 0x00010004;
+const unsigned VERSION_TRAPS    = 0x00010003;
+const unsigned VERSION_DISTANCE = 0x00010002;
+const unsigned VERSION_ORIGINAL = 0x00010001;
+
+
+// Version 2 layout
+//
+//    signature, version, meta data, traps, schema (as version 1.4)
+//    rows per tile, tile count
+//    tile codec (2.1 and up)
+//    offset of the stats, 0 if none (2.2 and up)
+//    tile index - offset and size of each tile
+//    padding to DATA_ALIGN
+//    tiles
+//    stats
+//
+// A tile is a band of rows. It holds one block per channel, each the
+// channel's column for every row of the tile back to back. Blocks and
+// tiles start on a TILE_ALIGN boundary. Since the columns are stored as
+// they are in memory, the rows of a mapped file are used directly.
+//
+// Packed tiles hold the channel blocks one after the other, each packed
+// by pack_channel().
+//
+// All values - header, tile index, stats and the raw columns - are
+// little-endian. They are written and read (and raw tiles are used in
+// place) in the host's byte order, so only little-endian hosts are
+// supported.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "The .fract format is little-endian and is only supported on little-endian hosts"
+#endif
+const int ROWS_PER_TILE = 64;
+const std::size_t TILE_ALIGN = 64;
+const std::size_t DATA_ALIGN = 4096;
+
+std::size_t align_up(std::size_t n, std::size_t alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
 
+// Offsets of the channel blocks in a tile of the given number of rows.
+// Returns the size of the tile.
+std::size_t tile_layout(channel_schema const &schema, int width, int rows,
+        std::vector<std::size_t> &offsets) {
+    std::size_t size = 0;
+    offsets.clear();
+    for (auto const &ch : schema) {
+        size = align_up(size, TILE_ALIGN);
+        offsets.push_back(size);
+        size += column_size(ch, width) * rows;
+    }
+    return size;
+}
 
 template<class Archive> void serialize(Archive & archive,
                fractal_meta_data & fmd)
@@ -16,13 +82,76 @@ template<class Archive> void serialize(Archive & archive,
 }
 
 template<class Archive> void serialize(Archive & archive,
-               fractal_point_data & fpd)
+               tile_entry & tile)
+{
+    archive(tile.offset, tile.size);
+}
+
+template<class Archive> void serialize(Archive & archive,
+               fractal_stats & stats)
+{
+    archive(stats.min_iterations, stats.max_iterations, stats.diverged_count,
+            stats.histogram);
+}
+
+template<class Archive> void serialize(Archive & archive,
+               orbit_trap & trap)
+{
+    int kind = static_cast<int>(trap.kind);
+    archive(kind, trap.center, trap.angle);
+    trap.kind = static_cast<trap_kind>(kind);
+}
+
+template<class Archive> void serialize(Archive & archive,
+               channel_desc & ch)
 {
-    archive(fpd.last_value, fpd.last_modulus, fpd.iterations, fpd.diverged);
+    auto id = static_cast<std::uint8_t>(ch.id);
+    auto type = static_cast<std::uint8_t>(ch.type);
+    archive(id, type, ch.count);
+    ch.id = static_cast<channel_id>(id);
+    ch.type = static_cast<channel_type>(type);
+}
+
+// Make sure a schema read from a file is something we can handle.
+void check_schema(channel_schema const &schema, fractal_meta_data const &fmd) {
+    auto supported = make_schema(~channel_set{0}, fmd.trap_count);
+    for (int limit : { 0, 0x10000 }) {
+        auto compact = make_schema(~channel_set{0}, fmd.trap_count,
+                point_encoding::compact, limit);
+        supported.insert(supported.end(), compact.begin(), compact.end());
+    }
+    channel_set seen = 0;
+
+    for (auto const &ch : schema) {
+        if (static_cast<int>(ch.id) >= CHANNEL_ID_COUNT)
+            throw std::runtime_error("Unknown channel in file");
+        if (seen & channel_bit(ch.id))
+            throw std::runtime_error("Duplicate channel in file");
+        seen |= channel_bit(ch.id);
+
+        bool found = false;
+        for (auto const &s : supported) {
+            found = found or (s == ch);
+        }
+        if (not found)
+            throw std::runtime_error("Unsupported channel type in file");
+    }
+
+    if ((seen & CORE_CHANNELS) != CORE_CHANNELS)
+        throw std::runtime_error("File is missing the core channels");
+}
+
+// For compilers that do not say what the byte order is
+void check_byte_order() {
+    const std::uint16_t one = 1;
+    if (*reinterpret_cast<const unsigned char *>(&one) != 1)
+        throw std::runtime_error(".fract files can only be used on little-endian hosts");
 }
 
 void FractalFile::add_metadata( fractal_meta_data const &fmd ) {
 
+    check_byte_order();
+
     if (has_meta_) {
         throw std::runtime_error("Metadata already added");
     }
@@ -38,7 +167,29 @@ void FractalFile::add_metadata( fractal_meta_data const &fmd ) {
 
     cereal::BinaryOutputArchive oarchive(fstrm_);
 
+    meta_pos_ = fstrm_.tellp();
     oarchive(fmd);
+    oarchive(fmd.trap_count);
+    for (int i = 0; i < fmd.trap_count; ++i)
+        oarchive(fmd.traps[i]);
+
+    schema_ = make_schema(fmd.channels, fmd.trap_count, fmd.encoding, fmd.limit);
+    metadata_.channels = schema_channels(schema_);
+    oarchive(std::uint32_t(schema_.size()));
+    for (auto &ch : schema_)
+        oarchive(ch);
+
+    // The stats offset and the index are filled in by finalize()
+    std::uint32_t tile_count = (fmd.samples_img + ROWS_PER_TILE - 1) / ROWS_PER_TILE;
+    oarchive(std::uint32_t(ROWS_PER_TILE), tile_count);
+    oarchive(static_cast<std::uint32_t>(tile_codec_));
+    index_pos_ = fstrm_.tellp();
+    oarchive(std::uint64_t(0));
+    tiles_.assign(tile_count, tile_entry{});
+    for (auto &tile : tiles_)
+        oarchive(tile);
+
+    pad_to(DATA_ALIGN);
 
     has_meta_ = true;
 
@@ -57,13 +208,58 @@ void FractalFile::write_row(point_row const &rs) {
     if (rs.size() != expected_columns)
         throw std::runtime_error("Incorrect number of results in vector\n");
 
+    if (rs.schema() != schema_)
+        throw std::runtime_error("Row does not have the file's channels\n");
+
+    int width = metadata_.samples_real;
+    int row_in_tile = row_count_ % ROWS_PER_TILE;
+    int tile_rows = std::min(ROWS_PER_TILE, metadata_.samples_img - 
+            (row_count_ - row_in_tile));
+
+    if (row_in_tile == 0) {
+        tile_buffer_.assign(tile_layout(schema_, width, tile_rows, tile_offsets_), 0);
+    }
+
+    for (std::size_t k = 0; k < schema_.size(); ++k) {
+        auto size = column_size(schema_[k], width);
+        std::memcpy(tile_buffer_.data() + tile_offsets_[k] + size * row_in_tile,
+                rs.column(k), size);
+    }
+
     row_count_ += 1;
 
-    cereal::BinaryOutputArchive oarchive(fstrm_);
+    if (row_in_tile + 1 == tile_rows)
+        write_tile();
+}
+
+void FractalFile::write_tile() {
+    pad_to(TILE_ALIGN);
+
+    auto &tile = tiles_[(row_count_ - 1) / ROWS_PER_TILE];
+    tile.offset = fstrm_.tellp();
 
-    for (auto const &fpd : rs) {
-        oarchive(fpd);
+    if (tile_codec_ == tile_codec::packed) {
+        int tile_rows = (row_count_ - 1) % ROWS_PER_TILE + 1;
+        packed_buffer_.clear();
+        for (std::size_t k = 0; k < schema_.size(); ++k) {
+            pack_channel(schema_[k], tile_buffer_.data() + tile_offsets_[k],
+                    column_size(schema_[k], metadata_.samples_real) * tile_rows,
+                    packed_buffer_);
+        }
+        tile.size = packed_buffer_.size();
+        fstrm_.write(reinterpret_cast<const char*>(packed_buffer_.data()), packed_buffer_.size());
+        return;
     }
+
+    tile.size = tile_buffer_.size();
+
+    fstrm_.write(reinterpret_cast<const char*>(tile_buffer_.data()), tile_buffer_.size());
+}
+
+void FractalFile::pad_to(std::size_t alignment) {
+    std::size_t pos = fstrm_.tellp();
+    static const char zeros[DATA_ALIGN] = {};
+    fstrm_.write(zeros, align_up(pos, alignment) - pos);
 }
 
 
@@ -76,6 +272,24 @@ void FractalFile::finalize() {
     if (row_count_ != expected_rows)
         throw std::runtime_error("incorrect numberof rows.\n");
 
+    cereal::BinaryOutputArchive oarchive(fstrm_);
+
+    std::uint64_t stats_offset = 0;
+    if (has_stats_) {
+        pad_to(TILE_ALIGN);
+        stats_offset = fstrm_.tellp();
+        oarchive(stats_);
+
+        metadata_.max_iterations = stats_.max_iterations;
+        metadata_.min_iterations = stats_.min_iterations;
+        fstrm_.seekp(meta_pos_);
+        oarchive(metadata_);
+    }
+
+    fstrm_.seekp(index_pos_);
+    oarchive(stats_offset);
+    for (auto &tile : tiles_)
+        oarchive(tile);
 
     fstrm_.close();
 }
@@ -89,6 +303,28 @@ std::unique_ptr<FractalFile> FractalFile::read_from_file(std::string file_name)
     return retval;
 }
 
+std::unique_ptr<FractalFile> FractalFile::from_memory(std::string file_name,
+        fractal_meta_data const &fmd, std::shared_ptr<point_grid> rows,
+        fractal_stats const &stats) {
+
+    if (rows->size() != fmd.samples_img)
+        throw std::runtime_error("Incorrect number of rows for the meta data");
+
+    auto retval = std::make_unique<FractalFile>(file_name);
+
+    retval->metadata_ = fmd;
+    retval->schema_ = make_schema(fmd.channels, fmd.trap_count, fmd.encoding, fmd.limit);
+    retval->metadata_.channels = schema_channels(retval->schema_);
+    retval->metadata_.encoding = schema_encoding(retval->schema_);
+    retval->has_meta_ = true;
+    retval->version_ = VERSION;
+
+    retval->rows_ = rows;
+    retval->set_stats(stats);
+
+    return retval;
+}
+
 fractal_meta_data 
 FractalFile::read_meta_data_from_file(std::string file_name) {
     FractalFile ff(file_name);
@@ -100,6 +336,8 @@ FractalFile::read_meta_data_from_file(std::string file_name) {
 }
 
 void FractalFile::read_meta_data() {
+    check_byte_order();
+
     fstrm_.open(file_name_,
             std::ios::in | std::ios::binary);
 
@@ -111,13 +349,115 @@ void FractalFile::read_meta_data() {
     if  ( *(reinterpret_cast<unsigned*>(buffer)) != SIGNATURE) 
         throw std::runtime_error("Sig does not match");
     fstrm_.read(buffer, sizeof(VERSION));
+    if (fstrm_.gcount() != sizeof(VERSION))
+       throw std::runtime_error("Could not read file version");
+    version_ = *(reinterpret_cast<unsigned*>(buffer));
+    if (version_ < VERSION_ORIGINAL or version_ > VERSION_STATS)
+        throw std::runtime_error("Unsupported file version");
 
 
     cereal::BinaryInputArchive iarchive(fstrm_);
     iarchive(metadata_);
+
+    // Older versions have an implied schema
+    channel_set channels = DEFAULT_CHANNELS;
+
+    if (version_ >= VERSION_DISTANCE and version_ < VERSION_SCHEMA) {
+        bool has_distance;
+        iarchive(has_distance);
+        if (has_distance)
+            channels |= channel_bit(channel_id::distance);
+    }
+    if (version_ >= VERSION_TRAPS) {
+        iarchive(metadata_.trap_count);
+        if (metadata_.trap_count < 0 or metadata_.trap_count > MAX_TRAPS)
+            throw std::runtime_error("Invalid trap count in file");
+        for (int i = 0; i < metadata_.trap_count; ++i)
+            iarchive(metadata_.traps[i]);
+    } else {
+        metadata_.trap_count = 0;
+    }
+    if (metadata_.trap_count > 0)
+        channels |= channel_bit(channel_id::trap);
+
+    if (version_ >= VERSION_SCHEMA) {
+        std::uint32_t count;
+        iarchive(count);
+        if (count > unsigned(CHANNEL_ID_COUNT))
+            throw std::runtime_error("Invalid channel count in file");
+        schema_.resize(count);
+        for (auto &ch : schema_)
+            iarchive(ch);
+        check_schema(schema_, metadata_);
+    } else {
+        schema_ = make_schema(channels, metadata_.trap_count);
+    }
+
+    if (version_ >= VERSION_TILED) {
+        std::uint32_t rows_per_tile, tile_count;
+        iarchive(rows_per_tile, tile_count);
+        if (rows_per_tile == 0 or tile_count != 
+                (unsigned(metadata_.samples_img) + rows_per_tile - 1) / rows_per_tile)
+            throw std::runtime_error("Invalid tile index in file");
+        rows_per_tile_ = rows_per_tile;
+
+        tile_codec_ = tile_codec::raw;
+        if (version_ >= VERSION_CODEC) {
+            std::uint32_t codec;
+            iarchive(codec);
+            if (codec > static_cast<std::uint32_t>(tile_codec::packed))
+                throw std::runtime_error("Unknown tile codec in file");
+            tile_codec_ = static_cast<tile_codec>(codec);
+        }
+        std::uint64_t stats_offset = 0;
+        if (version_ >= VERSION_STATS)
+            iarchive(stats_offset);
+        tiles_.resize(tile_count);
+        for (auto &tile : tiles_)
+            iarchive(tile);
+
+        if (stats_offset != 0) {
+            fstrm_.seekg(stats_offset);
+            iarchive(stats_);
+            if (stats_.histogram.size() != std::size_t(metadata_.limit) + 1)
+                throw std::runtime_error("Invalid stats in file");
+            has_stats_ = true;
+        }
+    }
+
+    metadata_.channels = schema_channels(schema_);
+    metadata_.encoding = schema_encoding(schema_);
     has_meta_ = true;
 }
 
+// Copy one field out of count records into a column.
+template<std::size_t Size>
+void gather_field(unsigned char *out, unsigned char const *in,
+        std::size_t record_size, int count) {
+    for (int j = 0; j < count; ++j) {
+        std::memcpy(out, in, Size);
+        out += Size;
+        in += record_size;
+    }
+}
+
+void gather_field(unsigned char *out, unsigned char const *in,
+        std::size_t value_size, std::size_t record_size, int count) {
+    // The common sizes get a fixed size copy.
+    switch (value_size) {
+        case 1 :  gather_field<1>(out, in, record_size, count); return;
+        case 4 :  gather_field<4>(out, in, record_size, count); return;
+        case 8 :  gather_field<8>(out, in, record_size, count); return;
+        case 16 : gather_field<16>(out, in, record_size, count); return;
+    }
+
+    for (int j = 0; j < count; ++j) {
+        std::memcpy(out, in, value_size);
+        out += value_size;
+        in += record_size;
+    }
+}
+
 void FractalFile::read_data() {
 
     read_meta_data();
@@ -127,20 +467,191 @@ void FractalFile::read_data() {
 
     rows_ = std::make_shared<point_grid>(expected_rows);
 
-    cereal::BinaryInputArchive iarchive(fstrm_);
+    if (version_ >= VERSION_TILED) {
+        fstrm_.close();
+        read_tiles();
+        return;
+    }
+
+    std::size_t data_start = fstrm_.tellg();
+    fstrm_.close();
 
-    for (int i = 0; i < expected_rows; ++i) {
-        auto new_row = std::make_shared<point_row>(expected_cols);
-        for (int j = 0; j < expected_cols; ++j) {
-            iarchive((*new_row)[j]);
+    auto mapping = std::make_shared<MappedFile>(file_name_);
+
+    if (version_ >= VERSION_COLUMNS) {
+        // Each row is a block of its columns, as in memory - use the
+        // rows in place.
+        std::size_t row_size = 0;
+        for (auto const &ch : schema_)
+            row_size += column_size(ch, expected_cols);
+        check_data_size(*mapping, data_start, row_size);
+
+        for (int i = 0; i < expected_rows; ++i) {
+            auto *next = mapping->data() + data_start + row_size * i;
+            std::vector<unsigned char *> columns;
+            for (auto const &ch : schema_) {
+                columns.push_back(next);
+                next += column_size(ch, expected_cols);
+            }
+            (*rows_)[i] = std::make_shared<point_row>(expected_cols, schema_,
+                    std::move(columns), mapping);
         }
 
-        (*rows_)[i] = new_row;
+        return;
+    }
+
+    // Older versions store each point as a fixed size record of the
+    // channels, so every row can be found and decoded independently.
+    std::size_t record_size = schema_record_size(schema_);
+    std::size_t row_size = record_size * expected_cols;
+    check_data_size(*mapping, data_start, row_size);
+
+    parallel_for(expected_rows, 0, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            auto new_row = std::make_shared<point_row>(expected_cols, schema_);
+            auto const *in = mapping->data() + data_start + row_size * i;
+
+            for (std::size_t k = 0; k < schema_.size(); ++k) {
+                std::size_t value_size = channel_type_size(schema_[k].type) * schema_[k].count;
+                gather_field(new_row->column(k), in, value_size, record_size,
+                        expected_cols);
+                in += value_size;
+            }
+
+            (*rows_)[i] = new_row;
+        }
+    });
+}
+
+void FractalFile::check_data_size(MappedFile const &mapping,
+        std::size_t data_start, std::size_t row_size) const {
+    if (data_start > mapping.size() or 
+            (mapping.size() - data_start) / row_size < std::size_t(metadata_.samples_img))
+        throw std::runtime_error("Unexpected end of file");
+}
 
+// Raw tiles are used in place as views of the mapped file. Packed tiles
+// are unpacked in parallel into a block with the raw tile layout.
+void FractalFile::read_tiles() {
+    auto mapping = std::make_shared<MappedFile>(file_name_);
+
+    parallel_for(tiles_.size(), 0, [&](int begin, int end) {
+        for (int t = begin; t < end; ++t) {
+            auto const &tile = tiles_[t];
+            if (tile.offset > mapping->size() or 
+                    tile.size > mapping->size() - tile.offset)
+                throw std::runtime_error("Tile " + std::to_string(t) +
+                        " is outside of the file");
+
+            decode_tile(t, mapping->data() + tile.offset, mapping,
+                    rows_->begin() + t * rows_per_tile_);
+        }
+    });
+}
+
+// Make the rows of tile t from its stored bytes at data. Raw tiles are
+// used in place and kept alive by owner. Packed tiles are unpacked into a
+// new block.
+void FractalFile::decode_tile(int t, unsigned char *data,
+        std::shared_ptr<void> owner, std::shared_ptr<point_row> *rows) const {
+
+    int width = metadata_.samples_real;
+    int first_row = t * rows_per_tile_;
+    int tile_rows = std::min(rows_per_tile_, metadata_.samples_img - first_row);
+
+    std::vector<std::size_t> offsets;
+    auto tile_size = tile_layout(schema_, width, tile_rows, offsets);
+
+    auto const &tile = tiles_[t];
+    unsigned char *base = data;
+
+    if (tile_codec_ == tile_codec::raw) {
+        if (tile.size != tile_size)
+            throw std::runtime_error("Tile has the wrong size");
+    } else {
+        auto block = std::shared_ptr<unsigned char>(
+                new unsigned char[tile_size](), 
+                std::default_delete<unsigned char[]>());
+
+        auto const *in = data;
+        auto const *in_end = data + tile.size;
+        for (std::size_t k = 0; k < schema_.size(); ++k) {
+            in = unpack_channel(schema_[k], in, in_end, block.get() + offsets[k],
+                    column_size(schema_[k], width) * tile_rows);
+        }
+        if (in != in_end)
+            throw std::runtime_error("Packed tile has extra data");
+
+        base = block.get();
+        owner = block;
     }
 
-    fstrm_.close();
+    for (int r = 0; r < tile_rows; ++r) {
+        std::vector<unsigned char *> columns;
+        for (std::size_t k = 0; k < schema_.size(); ++k) {
+            columns.push_back(base + offsets[k] + column_size(schema_[k], width) * r);
+        }
+        rows[r] = std::make_shared<point_row>(width, schema_,
+                std::move(columns), owner);
+    }
+}
+
+std::unique_ptr<FractalFile> FractalFile::open_tiles(std::string file_name) {
+
+    auto retval = std::make_unique<FractalFile>(file_name);
+
+    retval->read_meta_data();
+    retval->fstrm_.close();
+
+    if (retval->version_ < VERSION_TILED)
+        retval->read_data();
 
+    return retval;
+}
+
+// Each call reads with its own stream, so that tiles can be read on
+// several threads at once.
+std::vector<std::shared_ptr<point_row>> FractalFile::read_tile(int t) const {
+    if (t < 0 or t >= tile_count())
+        throw std::runtime_error("No such tile in the file");
+
+    auto const &tile = tiles_[t];
+    auto tile_name = "Tile " + std::to_string(t);
+
+    int first_row = t * rows_per_tile_;
+    int tile_rows = std::min(rows_per_tile_, metadata_.samples_img - first_row);
+
+    // Check the index before trusting it with an allocation. A packed
+    // tile is at most its raw size plus a marker byte per channel.
+    std::vector<std::size_t> offsets;
+    std::uint64_t max_size = tile_layout(schema_, metadata_.samples_real,
+            tile_rows, offsets);
+    if (tile_codec_ != tile_codec::raw)
+        max_size += schema_.size();
+    if (tile.size > max_size)
+        throw std::runtime_error(tile_name + " is larger than a tile can be");
+
+    std::ifstream in(file_name_, std::ios::in | std::ios::binary);
+    in.seekg(0, std::ios::end);
+    std::uint64_t file_length = in.tellg();
+    if (not in or tile.offset > file_length or
+            tile.size > file_length - tile.offset)
+        throw std::runtime_error(tile_name + " is outside of the file");
+
+    auto block = std::shared_ptr<unsigned char>(
+            new unsigned char[tile.size], 
+            std::default_delete<unsigned char[]>());
+
+    in.seekg(tile.offset);
+    in.read(reinterpret_cast<char *>(block.get()), tile.size);
+    if (not in or std::uint64_t(in.gcount()) != tile.size)
+        throw std::runtime_error(tile_name + " could not be read");
+
+    auto retval = std::vector<std::shared_ptr<point_row>>(tile_rows);
+
+    decode_tile(t, block.get(), block, retval.data());
+
+    return retval;
 }
 
 fractal_meta_data FractalFile::get_meta_data() const {
@@ -0,0 +1,58 @@
+#include "gradient.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+
+void gradient::add_stop(double t, pixel color) {
+    t = std::clamp(t, 0.0, 1.0);
+
+    // after any stops at the same t, so that two stops at one place make
+    // a hard edge
+    auto pos = std::upper_bound(stops_.begin(), stops_.end(), t,
+            [](double t, stop const &s) { return t < s.t; });
+    stops_.insert(pos, stop{t, color});
+
+    bake();
+}
+
+pixel gradient::cycle(double t) const {
+    return at(t - std::floor(t));
+}
+
+namespace {
+
+std::uint32_t mix(std::uint32_t a, std::uint32_t b, double f) {
+    return std::uint32_t(std::lround(a + (double(b) - double(a)) * f));
+}
+
+} // namespace
+
+void gradient::bake() {
+    lut_.resize(LUT_SIZE);
+
+    std::size_t next = 0;
+    for (int i = 0; i < LUT_SIZE; ++i) {
+        double t = double(i) / (LUT_SIZE - 1);
+
+        while (next < stops_.size() and stops_[next].t <= t)
+            ++next;
+
+        if (next == 0) {
+            lut_[i] = stops_.front().color;
+        } else if (next == stops_.size()) {
+            lut_[i] = stops_.back().color;
+        } else {
+            auto const &lo = stops_[next - 1];
+            auto const &hi = stops_[next];
+            double f = (t - lo.t) / (hi.t - lo.t);
+
+            pixel p;
+            p.red_   = mix(lo.color.red_,   hi.color.red_,   f);
+            p.green_ = mix(lo.color.green_, hi.color.green_, f);
+            p.blue_  = mix(lo.color.blue_,  hi.color.blue_,  f);
+            lut_[i] = p;
+        }
+    }
+}
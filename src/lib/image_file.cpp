@@ -0,0 +1,39 @@
+#include "image_file.hpp"
+
+#include "bmp_file.hpp"
+#include "ppm_file.hpp"
+
+#include <limits>
+#include <stdexcept>
+
+namespace {
+
+bool is_ppm(std::string const &file_name) {
+    std::string const ext = ".ppm";
+    return file_name.size() >= ext.size() and
+        file_name.compare(file_name.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+}
+
+std::unique_ptr<ImageFile> make_image_file(std::string const &file_name,
+        int height, int width) {
+
+    check_image_size(file_name, height, width);
+
+    if (is_ppm(file_name))
+        return std::make_unique<PPMFile>(file_name, height, width);
+
+    return std::make_unique<BMPFile>(file_name, height, width);
+}
+
+void check_image_size(std::string const &file_name, int height, int width) {
+    if (is_ppm(file_name))
+        return;
+
+    if (BMPFile::file_size(height, width) > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("A " + std::to_string(width) + "x" + 
+                std::to_string(height) + " image is too large for a BMP file (4 GB at most)"
+                " - write a .ppm file (mandel --ppm) instead");
+    }
+}
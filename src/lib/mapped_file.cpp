@@ -0,0 +1,40 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+MappedFile::MappedFile(std::string file_name) : file_name_{file_name} {
+    int fd = ::open(file_name_.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + file_name_);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat " + file_name_);
+    }
+
+    size_ = st.st_size;
+
+    if (size_ > 0) {
+        void *p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Could not map " + file_name_);
+        }
+        data_ = static_cast<unsigned char *>(p);
+    }
+
+    // the mapping stays valid after the close
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_)
+        ::munmap(data_, size_);
+}
@@ -0,0 +1,42 @@
+#include "ppm_file.hpp"
+
+#include <stdexcept>
+#include <string>
+
+void PPMFile::initialize_file() {
+
+    out_stream_.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    out_stream_.open(file_name_, std::ios::out|std::ofstream::trunc|std::ofstream::binary);
+
+    auto header = "P6\n" + std::to_string(width_) + " " + std::to_string(height_) + "\n255\n";
+    out_stream_.write(header.data(), header.size());
+    data_offset_ = header.size();
+
+    buffer_.resize(std::size_t(width_) * 3);
+}
+
+void PPMFile::write_row(std::vector<pixel> const & data) {
+    if (current_row_ == 0)
+        initialize_file();
+
+    if (current_row_ >= height_) {
+        throw std::runtime_error("Writing more rows than allowed by the height");
+    }
+
+    if (data.size() != (unsigned)width_) {
+        throw std::runtime_error("row size is incorrect for width");
+    }
+
+    auto *out = buffer_.data();
+    for (auto const &p : data) {
+        *out++ = static_cast<unsigned char>(p.red_);
+        *out++ = static_cast<unsigned char>(p.green_);
+        *out++ = static_cast<unsigned char>(p.blue_);
+    }
+
+    std::uint64_t line = height_ - 1 - current_row_;
+    out_stream_.seekp(data_offset_ + line * buffer_.size());
+    out_stream_.write(reinterpret_cast<const char *>(buffer_.data()), buffer_.size());
+
+    current_row_ += 1;
+}
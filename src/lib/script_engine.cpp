@@ -7,8 +7,22 @@
 #include <scriptmath/scriptmathcomplex.h>
 #include <scriptarray/scriptarray.h>
 
+#if defined(MANDEL_SCRIPT_JIT)
+#include <as_jit.h>
+#endif
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/map.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/vector.hpp>
+
 #include <iostream>
 #include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
 
 
 
@@ -34,6 +48,18 @@ ScriptEngine::~ScriptEngine() {
     if (engine_) {
         engine_->ShutDownAndRelease();
     }
+#if defined(MANDEL_SCRIPT_JIT)
+    // after the engine, which releases the compiled functions through it
+    delete static_cast<asCJITCompiler *>(builtin_jit_);
+#endif
+}
+
+bool ScriptEngine::has_builtin_jit() {
+#if defined(MANDEL_SCRIPT_JIT)
+    return true;
+#else
+    return false;
+#endif
 }
 
 asIScriptFunction *ScriptEngine::find_function(std::string const& func_decl) {
@@ -71,24 +97,44 @@ asIScriptModule *ScriptEngine::get_module() {
 }
 
 void ScriptEngine::print_exception_info() {
+    print_exception_info(context_);
+}
+
+void ScriptEngine::print_exception_info(asIScriptContext *ctx) {
     // Determine the exception that occurred
     std::cerr << "Script Exception:\n";
-    std::cerr << "desc : " << context_->GetExceptionString() << "\n";
+    std::cerr << "desc : " << ctx->GetExceptionString() << "\n";
 
     // Determine the function where the exception occurred
-    auto const *function = context_->GetExceptionFunction();
+    auto const *function = ctx->GetExceptionFunction();
     std::cerr << "func : " << function->GetDeclaration() << "\n";
     std::cerr << "modl : " << function->GetModuleName() << "\n";
     std::cerr << "sect : " << function->GetScriptSectionName() << "\n";
 
-    std::cerr << "line : " << context_->GetExceptionLineNumber() << "\n";
+    std::cerr << "line : " << ctx->GetExceptionLineNumber() << "\n";
+}
+
+bool ScriptEngine::has_metadata(asIScriptFunction *func, std::string const &tag) const {
+    auto iter = metadata_.find(func);
+    if (iter == metadata_.end())
+        return false;
+
+    for (auto const &md : iter->second) {
+        if (md == tag)
+            return true;
+    }
+    return false;
 }
 
 bool ScriptEngine::execute_context() {
-    if (not context_)
+    return execute_context(context_);
+}
+
+bool ScriptEngine::execute_context(asIScriptContext *ctx) {
+    if (not ctx)
         throw std::runtime_error("Context has not been created");
 
-    int r = context_->Execute();
+    int r = ctx->Execute();
     std::string msg;
     switch (r) {
         case asEXECUTION_FINISHED:
@@ -102,7 +148,7 @@ bool ScriptEngine::execute_context() {
             break;
         case asEXECUTION_EXCEPTION :
             msg = "Execution was terminated with exception";
-            print_exception_info();
+            print_exception_info(ctx);
             break;
         case asEXECUTION_PREPARED :
             msg = "Context ready for new execution";
@@ -127,6 +173,209 @@ bool ScriptEngine::execute_context() {
 }
 
 
+namespace {
+
+// 64 bit FNV-1a. Only used to tell whether a cached module is stale.
+struct fnv_hash {
+    std::uint64_t value = 0xcbf29ce484222325;
+
+    void add(void const *data, std::size_t size) {
+        auto const *bytes = static_cast<unsigned char const *>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            value ^= bytes[i];
+            value *= 0x100000001b3;
+        }
+    }
+
+    void add(std::string const &s) {
+        add(s.data(), s.size());
+        // so that "ab","c" and "a","bc" differ
+        add("", 1);
+    }
+
+    void add(std::uint64_t v) {
+        add(&v, sizeof(v));
+    }
+};
+
+std::string read_file(std::string const &path) {
+    std::ifstream strm{path, std::ios::in | std::ios::binary};
+    return std::string(std::istreambuf_iterator<char>(strm), {});
+}
+
+// What the script source is. The builder is told to include files through
+// here so that the included files are part of the hash.
+struct source_hash {
+    fnv_hash hash;
+};
+
+int hash_include(const char *include, const char *from, CScriptBuilder *builder,
+        void *user_param) {
+
+    // Same rule as the builder - relative to the including file.
+    namespace fs = std::filesystem;
+    fs::path path = include;
+    if (path.is_relative())
+        path = fs::path(from).parent_path() / path;
+
+    static_cast<source_hash *>(user_param)->hash.add(read_file(path.string()));
+
+    return builder->AddSectionFromFile(path.string().c_str());
+}
+
+class file_stream : public asIBinaryStream {
+    std::iostream &strm_;
+  public:
+    explicit file_stream(std::iostream &strm) : strm_(strm) {}
+
+    int Read(void *ptr, asUINT size) override {
+        strm_.read(static_cast<char *>(ptr), size);
+        return strm_ ? 0 : -1;
+    }
+
+    int Write(const void *ptr, asUINT size) override {
+        strm_.write(static_cast<char const *>(ptr), size);
+        return strm_ ? 0 : -1;
+    }
+};
+
+// Script functions are matched up with their metadata by declaration
+std::string metadata_key(asIScriptFunction const *func) {
+    return func->GetDeclaration(true, true, false);
+}
+
+} // namespace
+
+// Everything registered with the engine, and how the engine is set up.
+// Bytecode saved with a different interface can not be loaded.
+std::uint64_t ScriptEngine::interface_hash() const {
+    fnv_hash hash;
+
+    hash.add(ANGELSCRIPT_VERSION_STRING);
+    hash.add(std::uint64_t(sizeof(void *)));
+    hash.add(std::uint64_t(jit_ != nullptr));
+
+    for (asUINT i = 0; i < engine_->GetGlobalFunctionCount(); ++i) {
+        hash.add(engine_->GetGlobalFunctionByIndex(i)->GetDeclaration(true, true, true));
+    }
+
+    for (asUINT i = 0; i < engine_->GetGlobalPropertyCount(); ++i) {
+        char const *name = nullptr;
+        int type_id = 0;
+        engine_->GetGlobalPropertyByIndex(i, &name, nullptr, &type_id);
+        hash.add(name);
+        hash.add(engine_->GetTypeDeclaration(type_id, true));
+    }
+
+    for (asUINT i = 0; i < engine_->GetObjectTypeCount(); ++i) {
+        auto const *type = engine_->GetObjectTypeByIndex(i);
+        hash.add(type->GetName());
+        hash.add(std::uint64_t(type->GetSize()));
+        hash.add(std::uint64_t(type->GetFlags()));
+        for (asUINT m = 0; m < type->GetMethodCount(); ++m)
+            hash.add(type->GetMethodByIndex(m)->GetDeclaration(true, true, true));
+        for (asUINT p = 0; p < type->GetPropertyCount(); ++p)
+            hash.add(type->GetPropertyDeclaration(p, true));
+        for (asUINT b = 0; b < type->GetBehaviourCount(); ++b) {
+            asEBehaviours behaviour;
+            auto const *func = type->GetBehaviourByIndex(b, &behaviour);
+            hash.add(std::uint64_t(behaviour));
+            hash.add(func->GetDeclaration(true, true, true));
+        }
+        for (asUINT f = 0; f < type->GetFactoryCount(); ++f)
+            hash.add(type->GetFactoryByIndex(f)->GetDeclaration(true, true, true));
+    }
+
+    for (asUINT i = 0; i < engine_->GetFuncdefCount(); ++i)
+        hash.add(engine_->GetFuncdefByIndex(i)->GetFuncdefSignature()->GetDeclaration(true, true, true));
+
+    return hash.value;
+}
+
+// Cached module file:
+//    u64 key, metadata (cereal), bytecode (asIScriptModule::SaveByteCode)
+bool ScriptEngine::load_cached_module(std::string const &path, std::uint64_t key) {
+    std::fstream strm{path, std::ios::in | std::ios::binary};
+    if (not strm)
+        return false;
+
+    std::uint64_t file_key = 0;
+    std::map<std::string, std::vector<std::string>> metadata;
+    try {
+        cereal::BinaryInputArchive iarchive(strm);
+        iarchive(file_key);
+        if (file_key != key)
+            return false;
+        iarchive(metadata);
+    } catch (cereal::Exception const &) {
+        return false;
+    }
+
+    // Load into a module of its own. The builder's module (with the
+    // script sections already added) is only replaced once the load has
+    // worked, so that a bad cache file can still be rebuilt from source.
+    engine_->DiscardModule("ColorizerCache");
+    auto *module = engine_->GetModule("ColorizerCache", asGM_ALWAYS_CREATE);
+
+    file_stream stream{strm};
+    if (module->LoadByteCode(&stream) < 0) {
+        std::cerr << "Could not load the cached script " << path << "\n";
+        engine_->DiscardModule("ColorizerCache");
+        return false;
+    }
+
+    engine_->DiscardModule("Colorizer");
+    module->SetName("Colorizer");
+
+    for (asUINT i = 0; i < module->GetFunctionCount(); ++i) {
+        auto *func = module->GetFunctionByIndex(i);
+        auto iter = metadata.find(metadata_key(func));
+        if (iter != metadata.end())
+            metadata_[func] = iter->second;
+    }
+
+    return true;
+}
+
+void ScriptEngine::save_cached_module(std::string const &path, std::uint64_t key) {
+    std::map<std::string, std::vector<std::string>> metadata;
+    for (auto const &[func, md] : metadata_) {
+        if (not md.empty())
+            metadata.emplace(metadata_key(func), md);
+    }
+
+    // Write to the side and move into place, so that a concurrent run
+    // never sees half a file.
+    std::string temp_path = path + ".tmp" + std::to_string(std::uint64_t(this));
+    {
+        std::fstream strm{temp_path, std::ios::out | std::ios::binary | std::ios::trunc};
+        if (not strm) {
+            std::cerr << "Could not write the script cache " << temp_path << "\n";
+            return;
+        }
+
+        {
+            cereal::BinaryOutputArchive oarchive(strm);
+            oarchive(key, metadata);
+        }
+
+        file_stream stream{strm};
+        if (get_module()->SaveByteCode(&stream) < 0 or not strm) {
+            std::cerr << "Could not write the script cache " << temp_path << "\n";
+            strm.close();
+            std::remove(temp_path.c_str());
+            return;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::cerr << "Could not write the script cache " << path << " : " << ec.message() << "\n";
+        std::remove(temp_path.c_str());
+    }
+}
+
 void script_log(std::string &s) {
 
     std::cerr << s;
@@ -141,6 +390,22 @@ void ScriptEngine::initialize(std::string const &script) {
     engine_ = asCreateScriptEngine();
 
     int r;
+
+#if defined(MANDEL_SCRIPT_JIT)
+    if (not jit_) {
+        builtin_jit_ = new asCJITCompiler(0);
+        jit_ = builtin_jit_;
+    }
+#endif
+    if (jit_) {
+        // The bytecode needs the JIT entry points, so this has to be set
+        // before the module is built.
+        r = engine_->SetEngineProperty(asEP_INCLUDE_JIT_INSTRUCTIONS, true);
+        assert(r >= 0);
+        r = engine_->SetJITCompiler(jit_);
+        assert(r >= 0);
+        std::cerr << "script JIT enabled\n";
+    }
     
     r= engine_->SetMessageCallback(asFUNCTION(MessageCallback), 0, 
             asCALL_CDECL);
@@ -167,7 +432,12 @@ void ScriptEngine::initialize(std::string const &script) {
 
     std::cerr << "interface registered\n";
 
+    source_hash sources;
+    sources.hash.add(interface_hash());
+    sources.hash.add(read_file(script));
+
     CScriptBuilder builder;
+    builder.SetIncludeCallback(hash_include, &sources);
     r = builder.StartNewModule(engine_, "Colorizer"); 
     if( r < 0 ) {
         // If the code fails here it is usually because there
@@ -183,7 +453,26 @@ void ScriptEngine::initialize(std::string const &script) {
         std::cerr << "Please correct the errors in the script and try again.\n";
         return;
     }
-    r = builder.BuildModule();
+
+    std::string cache_path;
+    bool from_cache = false;
+    if (not cache_dir_.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(cache_dir_, ec);
+
+        std::ostringstream name;
+        name << std::hex << sources.hash.value << ".asbc";
+        cache_path = (std::filesystem::path(cache_dir_) / name.str()).string();
+
+        from_cache = load_cached_module(cache_path, sources.hash.value);
+        if (from_cache) {
+            std::cerr << "loaded compiled script from " << cache_path << "\n";
+        } else {
+            r = builder.BuildModule();
+        }
+    } else {
+        r = builder.BuildModule();
+    }
     if( r < 0 ) {
         // An error occurred. Instruct the script writer to fix the 
         // compilation errors that were listed in the output stream.
@@ -191,5 +480,22 @@ void ScriptEngine::initialize(std::string const &script) {
         return;
     }
 
+#if defined(MANDEL_SCRIPT_JIT)
+    // make the generated code executable
+    if (builtin_jit_)
+        static_cast<asCJITCompiler *>(builtin_jit_)->finalizePages();
+#endif
+
+    if (not from_cache) {
+        auto *module = get_module();
+        for (asUINT i = 0; i < module->GetFunctionCount(); ++i) {
+            auto *func = module->GetFunctionByIndex(i);
+            metadata_[func] = builder.GetMetadataForFunc(func);
+        }
+    }
+
+    if (not cache_path.empty() and not from_cache)
+        save_cached_module(cache_path, sources.hash.value);
+
     std::cerr << "initialization complete\n";
 }
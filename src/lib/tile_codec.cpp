@@ -0,0 +1,226 @@
+#include "tile_codec.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+// How the values of a channel are laid out and compared.
+struct value_layout {
+    int width;      // bytes per value
+    int stride;     // values between a value and the one it is compared to
+    bool floating;  // xor instead of delta
+};
+
+value_layout layout_for(channel_desc const &ch) {
+    switch (ch.type) {
+        case channel_type::u8 :
+        case channel_type::bit :  return { 1, ch.count, false };
+        case channel_type::u16 :  return { 2, ch.count, false };
+        case channel_type::i32 :
+        case channel_type::u32 :  return { 4, ch.count, false };
+        case channel_type::f32 :  return { 4, ch.count, true };
+        case channel_type::f64 :  return { 8, ch.count, true };
+        // real and imaginary parts are separate values
+        case channel_type::c128 : return { 8, 2*ch.count, true };
+    }
+
+    throw std::runtime_error("Unknown channel type");
+}
+
+inline std::uint64_t load_value(unsigned char const *p, int width) {
+    switch (width) {
+        case 1 : return *p;
+        case 2 : { std::uint16_t v; std::memcpy(&v, p, 2); return v; }
+        case 4 : { std::uint32_t v; std::memcpy(&v, p, 4); return v; }
+        default: { std::uint64_t v; std::memcpy(&v, p, 8); return v; }
+    }
+}
+
+inline void store_value(unsigned char *p, int width, std::uint64_t value) {
+    switch (width) {
+        case 1 : *p = std::uint8_t(value); return;
+        case 2 : { std::uint16_t v = value; std::memcpy(p, &v, 2); return; }
+        case 4 : { std::uint32_t v = value; std::memcpy(p, &v, 4); return; }
+        default: std::memcpy(p, &value, 8); return;
+    }
+}
+
+// value - previous as a width byte signed number, zigzag encoded so that
+// small negative deltas are small too.
+inline std::uint64_t encode_delta(std::uint64_t value, std::uint64_t previous, int width) {
+    int shift = 64 - 8*width;
+    auto delta = std::int64_t((value - previous) << shift) >> shift;
+    return (std::uint64_t(delta) << 1) ^ std::uint64_t(delta >> 63);
+}
+
+inline std::uint64_t decode_delta(std::uint64_t zigzag, std::uint64_t previous, int width) {
+    auto delta = (zigzag >> 1) ^ (~(zigzag & 1) + 1);
+    auto value = previous + delta;
+    return (width == 8) ? value : value & ((std::uint64_t{1} << 8*width) - 1);
+}
+
+void put_varint(std::vector<unsigned char> &out, std::uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(std::uint8_t(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(std::uint8_t(v));
+}
+
+inline std::uint64_t get_varint(unsigned char const *&in, unsigned char const *in_end) {
+    std::uint64_t retval = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (in == in_end)
+            throw std::runtime_error("Packed tile is truncated");
+        auto byte = *in++;
+        retval |= std::uint64_t(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return retval;
+    }
+    throw std::runtime_error("Packed tile has a bad varint");
+}
+
+
+
+// A zero difference is written as a 0 byte followed by the length of the
+// run of zeros. The varint for any other difference never starts with a
+// 0 byte.
+template<int Width, bool Floating>
+void pack_values(unsigned char const *in, std::size_t count, std::size_t stride,
+        std::vector<unsigned char> &out) {
+
+    std::size_t zero_run = 0;
+
+    for (std::size_t i = 0; i < count; ++i) {
+        auto value = load_value(in + i*Width, Width);
+        std::uint64_t previous = (i >= stride) ?
+            load_value(in + (i - stride)*Width, Width) : 0;
+
+        auto diff = Floating ? value ^ previous : encode_delta(value, previous, Width);
+
+        if (diff == 0) {
+            zero_run += 1;
+            continue;
+        }
+
+        if (zero_run > 0) {
+            out.push_back(0);
+            put_varint(out, zero_run);
+            zero_run = 0;
+        }
+        put_varint(out, diff);
+    }
+
+    if (zero_run > 0) {
+        out.push_back(0);
+        put_varint(out, zero_run);
+    }
+}
+
+template<int Width, bool Floating>
+unsigned char const *unpack_values(unsigned char const *in, 
+        unsigned char const *in_end, unsigned char *out, std::size_t count,
+        std::size_t stride) {
+
+    std::size_t i = 0;
+
+    while (i < count) {
+        std::size_t run = 1;
+        std::uint64_t diff = 0;
+
+        if (in == in_end)
+            throw std::runtime_error("Packed tile is truncated");
+        if (*in == 0) {
+            ++in;
+            run = get_varint(in, in_end);
+            if (run == 0 or run > count - i)
+                throw std::runtime_error("Packed tile has a bad run");
+        } else {
+            diff = get_varint(in, in_end);
+        }
+
+        for (; run > 0; --run, ++i) {
+            std::uint64_t previous = (i >= stride) ?
+                load_value(out + (i - stride)*Width, Width) : 0;
+
+            auto value = Floating ? previous ^ diff : decode_delta(diff, previous, Width);
+
+            store_value(out + i*Width, Width, value);
+        }
+    }
+
+    return in;
+}
+
+} // namespace
+
+
+// How a channel block is stored in a packed tile
+const unsigned char BLOCK_STORED = 0;
+const unsigned char BLOCK_PACKED = 1;
+
+void pack_channel(channel_desc const &ch, unsigned char const *in,
+        std::size_t size, std::vector<unsigned char> &out) {
+
+    auto start = out.size();
+    out.push_back(BLOCK_PACKED);
+
+    auto layout = layout_for(ch);
+    std::size_t count = size / layout.width;
+
+    if (layout.floating) {
+        if (layout.width == 4)
+            pack_values<4, true>(in, count, layout.stride, out);
+        else
+            pack_values<8, true>(in, count, layout.stride, out);
+    } else {
+        switch (layout.width) {
+            case 1 : pack_values<1, false>(in, count, layout.stride, out); break;
+            case 2 : pack_values<2, false>(in, count, layout.stride, out); break;
+            default: pack_values<4, false>(in, count, layout.stride, out); break;
+        }
+    }
+
+    // Noisy data can come out bigger - store it as is instead.
+    if (out.size() - start > size + 1) {
+        out.resize(start);
+        out.push_back(BLOCK_STORED);
+        out.insert(out.end(), in, in + size);
+    }
+}
+
+unsigned char const *unpack_channel(channel_desc const &ch,
+        unsigned char const *in, unsigned char const *in_end,
+        unsigned char *out, std::size_t size) {
+
+    if (in == in_end)
+        throw std::runtime_error("Packed tile is truncated");
+
+    if (*in == BLOCK_STORED) {
+        ++in;
+        if (std::size_t(in_end - in) < size)
+            throw std::runtime_error("Packed tile is truncated");
+        std::memcpy(out, in, size);
+        return in + size;
+    }
+    if (*in++ != BLOCK_PACKED)
+        throw std::runtime_error("Packed tile has a bad block");
+
+    auto layout = layout_for(ch);
+    std::size_t count = size / layout.width;
+
+    if (layout.floating) {
+        if (layout.width == 4)
+            return unpack_values<4, true>(in, in_end, out, count, layout.stride);
+        return unpack_values<8, true>(in, in_end, out, count, layout.stride);
+    }
+
+    switch (layout.width) {
+        case 1 : return unpack_values<1, false>(in, in_end, out, count, layout.stride);
+        case 2 : return unpack_values<2, false>(in, in_end, out, count, layout.stride);
+        default: return unpack_values<4, false>(in, in_end, out, count, layout.stride);
+    }
+}
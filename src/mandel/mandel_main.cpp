@@ -1,11 +1,15 @@
 #include "fractalator.hpp"
 #include "colorator.hpp"
+#include "image_file.hpp"
 #include "cxxopts.hpp"
 
 #include "fractal_data.hpp"
 #include "fractal_file.hpp"
 
+#include <cctype>
+#include <cstdint>
 #include <filesystem>
+#include <future>
 
 namespace fs = std::filesystem;
 
@@ -16,6 +20,8 @@ struct mandel_options {
     std::string output_file;
     std::string script_file = "";
     std::string script_args = "";
+    std::string script_cache = "";
+    std::string colorizer = "";
     std::string aspect;
     double box;
     double center_real;
@@ -31,18 +37,68 @@ struct mandel_options {
     int    limit;
     bool   debug = false;
     bool   force = false;
+    bool   fused = false;
+    // write the image as <output>.ppm rather than <output>.bmp
+    bool   ppm = false;
+    // bytes the points may take in memory. 0 = no limit
+    std::uint64_t max_memory = 0;
     int    jobs;
+    bool   distance = false;
+    std::vector<orbit_trap> traps;
+    channel_set channels = DEFAULT_CHANNELS;
+    bool   compact = false;
+    bool   compress = false;
 
 };
 
 // -------------------------------------------------------------------
 
+// A size in bytes, with an optional K, M, G or T (powers of 1024)
+std::uint64_t parse_memory_size(std::string const &spec) {
+    std::size_t end = 0;
+    double value = 0.0;
+    try {
+        value = std::stod(spec, &end);
+    } catch (std::exception &) {
+        end = 0;
+    }
+
+    std::uint64_t scale = 1;
+    if (end > 0 and end + 1 == spec.size()) {
+        auto unit = std::string("KMGT").find(
+                std::toupper(static_cast<unsigned char>(spec[end])));
+        if (unit != std::string::npos) {
+            scale = std::uint64_t(1) << (10 * (unit + 1));
+            end += 1;
+        }
+    }
+
+    if (end == 0 or end != spec.size() or value <= 0.0)
+        throw std::runtime_error("Invalid memory size '" + spec + "'");
+
+    return std::uint64_t(value * scale);
+}
+
+// Memory the points of the whole fractal take when they are kept
+std::uint64_t points_size(fractal_meta_data const &fmd) {
+    auto schema = make_schema(fmd.channels, fmd.trap_count, fmd.encoding, fmd.limit);
+    std::uint64_t row_size = 0;
+    for (auto const &ch : schema)
+        row_size += column_size(ch, fmd.samples_real);
+    return row_size * fmd.samples_img;
+}
+
+// -------------------------------------------------------------------
+
 
 mandel_options parse_commandline(int argc, char**argv) {
 
     mandel_options clopts;
 
     bool help_option;
+    std::vector<std::string> trap_specs;
+    std::string channel_list;
+    std::string max_memory;
 
     cxxopts::Options options("mandel", "Mandelbrot Generator");
 
@@ -53,6 +109,14 @@ mandel_options parse_commandline(int argc, char**argv) {
         ("s,samples", "Number of samples in each dimension", cxxopts::value(clopts.samples)->default_value("0"))
         ("force", "Force recomputation of the fractal, even if the parameters match",
             cxxopts::value(clopts.force)->default_value("false"))
+        ("fused", "Color the rows as they are computed, without keeping the points or writing the .fract file. "
+            "The coloring sees min_iterations as 0 and max_iterations as the limit, so colorings that "
+            "scale by them (e.g. builtin:smooth-hsv, samples/algo2.as) give a different image",
+            cxxopts::value(clopts.fused)->default_value("false"))
+        ("ppm", "Write the image as a binary PPM file rather than a BMP file, for images over 4 GB",
+            cxxopts::value(clopts.ppm)->default_value("false"))
+        ("max-memory", "Most memory (e.g. 512M, 8G) the points may take. Larger fractals are "
+            "colored a tile at a time from the .fract file", cxxopts::value(max_memory))
         ("width", "Number of samples along the real axis", cxxopts::value(clopts.width)->default_value("0"))
         ("height", "Number of samples along the imaginary axis", cxxopts::value(clopts.height)->default_value("0"))
         ("aspect", "WxH samples along the axis - also computes new height", cxxopts::value(clopts.aspect))
@@ -65,9 +129,21 @@ mandel_options parse_commandline(int argc, char**argv) {
         ("cr", "Center Real", cxxopts::value(clopts.center_real))
         ("ci", "Center Imaginary", cxxopts::value(clopts.center_img))
         ("l,limit", "Number of iterations to check divergence", cxxopts::value(clopts.limit)->default_value("1000"))
-        ("j,jobs", "Number of parallel threads to use", cxxopts::value(clopts.jobs)->default_value("0"))
+        ("j,jobs", "Number of threads to compute and color with (0 = all cores)", cxxopts::value(clopts.jobs)->default_value("0"))
+        ("distance", "Compute the exterior distance estimate for each point", cxxopts::value(clopts.distance))
+        ("trap", "Orbit trap to evaluate, may be repeated (point:r,i line:r,i,deg cross:r,i[,deg])", 
+            cxxopts::value(trap_specs))
+        ("channels", "Comma separated data to compute for each point, in addition to the iterations. "
+            "Any of last_value,last_modulus,distance,period,traps,fraction or none",
+            cxxopts::value(channel_list)->default_value("last_value,last_modulus"))
+        ("compact", "Store the points in the compact encoding (16 bit iterations, floats, no last_value)",
+            cxxopts::value(clopts.compact))
+        ("compress", "Compress the .fract file (lossless)", cxxopts::value(clopts.compress))
         ("script", "angelscript file to read for coloring algorithm", cxxopts::value(clopts.script_file))
         ("a,args", "key value pairs separated by semi-colon to pass to script", cxxopts::value(clopts.script_args))
+        ("colorizer", "Native coloring algorithm to use instead of a script "
+            "(builtin:smooth-hsv, builtin:histogram, builtin:multi-erf or plugin:<path>)", cxxopts::value(clopts.colorizer))
+        ("script-cache", "Directory in which to keep compiled scripts", cxxopts::value(clopts.script_cache))
         ;
 
 
@@ -95,6 +171,36 @@ mandel_options parse_commandline(int argc, char**argv) {
         exit(1);
     }
 
+    if (trap_specs.size() > MAX_TRAPS) {
+        std::cerr << "At most " << MAX_TRAPS << " --trap options may be given\n";
+        exit(1);
+    }
+
+    try {
+        clopts.channels = parse_channels(channel_list) | CORE_CHANNELS;
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << "\n";
+        exit(1);
+    }
+
+    if (not max_memory.empty()) {
+        try {
+            clopts.max_memory = parse_memory_size(max_memory);
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            exit(1);
+        }
+    }
+
+    for (auto const &spec : trap_specs) {
+        try {
+            clopts.traps.push_back(parse_orbit_trap(spec));
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << "\n";
+            exit(1);
+        }
+    }
+
     if (clopts.samples > 0) {
         if (clopts.samples < 10) {
             std::cerr << "Samples must be 10 or greater\n";
@@ -110,8 +216,13 @@ mandel_options parse_commandline(int argc, char**argv) {
         exit(1);
     }
 
-    if (clopts.script_file == "") {
-        std::cerr << "No script file specified\n";
+    if (clopts.script_file == "" and clopts.colorizer == "") {
+        std::cerr << "No script file or colorizer specified\n";
+        exit(1);
+    }
+
+    if (clopts.script_file != "" and clopts.colorizer != "") {
+        std::cerr << "Only one of --script and --colorizer may be given\n";
         exit(1);
     }
 
@@ -270,6 +381,54 @@ int main (int argc, char*argv[]) {
 
     std::string fract_file_name = clopts.output_file + ".fract";
 
+    fractalator_options fract_opts{
+            fract_file_name,
+            clopts.aspect,
+            clopts.box,
+            clopts.center_real,
+            clopts.center_img,
+            clopts.samples,
+            clopts.escape,
+            clopts.left_top_real,
+            clopts.left_top_img,
+            clopts.right_bottom_real,
+            clopts.right_bottom_img,
+            clopts.width,
+            clopts.height,
+            clopts.limit,
+            clopts.debug,
+            clopts.jobs,
+            clopts.distance,
+            clopts.traps,
+            clopts.channels,
+            clopts.compact,
+            clopts.compress
+            };
+
+    colorator_options color_opts{
+            fract_file_name,
+            clopts.output_file + (clopts.ppm ? ".ppm" : ".bmp"),
+            clopts.script_file,
+            clopts.script_args,
+            clopts.jobs,
+            clopts.script_cache,
+            clopts.colorizer,
+            };
+
+    // Fail before the fractal is computed rather than after
+    try {
+        check_image_size(color_opts.output_file, clopts.height, clopts.width);
+    } catch (std::runtime_error &e) {
+        std::cerr << e.what() << "\n";
+        exit(1);
+    }
+
+    if (clopts.fused) {
+        compute_and_color_image(color_opts, make_fractal_params(fract_opts),
+                make_meta_data(fract_opts));
+        return 0;
+    }
+
     bool need_to_compute = true;
 
     if (clopts.force) {
@@ -278,15 +437,7 @@ int main (int argc, char*argv[]) {
         try {
             auto meta_data = FractalFile::read_meta_data_from_file(fract_file_name);
 
-            need_to_compute = not meta_data.similar( {
-                { clopts.left_top_real, clopts.left_top_img },
-                { clopts.right_bottom_real, clopts.right_bottom_img },
-                clopts.escape,
-                clopts.limit,
-                clopts.width,
-                clopts.height,
-                0,0
-                }) ;
+            need_to_compute = not meta_data.similar(make_meta_data(fract_opts));
         } catch (std::runtime_error &e) {
             // swallow any exception and just
             // go ahead a recompute.
@@ -295,38 +446,48 @@ int main (int argc, char*argv[]) {
     }
 
 
-    if (need_to_compute) {
-        compute_fractal({
-            clopts.output_file + ".fract",
-            clopts.aspect,
-            clopts.box,
-            clopts.center_real,
-            clopts.center_img,
-            clopts.samples,
-            clopts.escape,
-            clopts.left_top_real,
-            clopts.left_top_img,
-            clopts.right_bottom_real,
-            clopts.right_bottom_img,
-            clopts.width,
-            clopts.height,
-            clopts.limit,
-            clopts.debug,
-            clopts.jobs
-            });
+    // Points that do not fit in --max-memory are not kept. They are read
+    // back from the .fract file a tile at a time as they are colored.
+    auto points_bytes = points_size(make_meta_data(fract_opts));
+    bool stream = (clopts.max_memory > 0 and points_bytes > clopts.max_memory);
+    if (stream) {
+        std::cout << "points need " << (points_bytes >> 20) 
+            << " MB, coloring from the .fract file a tile at a time\n";
+    }
 
-    } else {
+    if (not need_to_compute) {
         std::cerr << "Reusing data\n";
+        auto data = stream ? FractalFile::open_tiles(fract_file_name)
+                : FractalFile::read_from_file(fract_file_name);
+        color_image(color_opts, *data);
+        return 0;
     }
 
-    auto data = FractalFile::read_from_file(fract_file_name);
+    fractal_stats stats;
 
-    color_image({
-            fract_file_name,
-            clopts.output_file + ".bmp",
-            clopts.script_file,
-            clopts.script_args,
-            }, *data);
+    if (stream) {
+        // The .fract file is written as the rows are computed and read
+        // back a tile at a time.
+        compute_and_write_fractal(fract_opts, stats);
+        color_image(color_opts, *FractalFile::open_tiles(fract_file_name));
+        return 0;
+    }
+
+    // Color straight from the computed points while the .fract file is
+    // written on another thread.
+    auto rows = compute_fractal(fract_opts, stats);
+
+    auto writer = std::async(std::launch::async, [&]() {
+        write_fractal_file(fract_opts, rows, stats);
+    });
+
+    auto data = FractalFile::from_memory(fract_file_name,
+            make_meta_data(fract_opts, stats.max_iterations, stats.min_iterations),
+            rows, stats);
+
+    color_image(color_opts, *data);
+
+    writer.get();
 
     return 0;
 }